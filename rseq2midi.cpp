@@ -3,6 +3,31 @@
 /* Copyright (C) 2010-11, Ruben Nunez */
 /**************************************/
 /* Changelog:                         */
+/*   26-10-16                         */
+/*     mapped input, no stdio reads   */
+/*     single-write MIDI output       */
+/*     pre-decoded command array      */
+/*     table-driven command dispatch  */
+/*     computed-goto dispatch, -bench */
+/*     note-offs kept in a min-heap   */
+/*     running status option (-r)     */
+/*     parallel track rendering (-p)  */
+/*     batch conversion (-j N)        */
+/*     reentrant Converter_t context  */
+/*     C library API (rseq2midi.h)    */
+/*     stdin/stdout via -, -o option  */
+/*     level-gated buffered logging   */
+/*     labels bound to decoded commands*/
+/*     LABL text viewed in place      */
+/*     per-track and per-file budgets */
+/*     call stack, memoized subroutines*/
+/*     -loops N, copied loop passes   */
+/*     control-flow dump (-analyze)   */
+/*     LABL entries rendered (-labels)*/
+/*     metadata scan (-scan)          */
+/*     compile-time event sinks       */
+/*     columnar event model (-events) */
+/*     SMF format 0 output (-format0) */
 /*   16-09-01  -Valley Bell           */
 /*     write mod depth as MIDI ctrl 1 */
 /*     turn debug ctrls into option   */
@@ -29,6 +54,11 @@
 /*     89 - Jump [offset]             */
 /*     8A - Call [offset]             */
 /*     B0 - Unknown                   */
+/*     B1 - ??? [1 arg]               */
+/*     B2 - ??? [1 arg]               */
+/*     B3 - ??? [1 arg]               */
+/*     B4 - ??? [1 arg]               */
+/*     B5 - ??? [1 arg]               */
 /*     C0 - Pan [0.127]               */
 /*     C1 - Volume [0.127]            */
 /*     C2 - Master volume [0.127]     */
@@ -52,19 +82,30 @@
 /*     D4 - Loop start [marker?]      */
 /*     D5 - Expression [0.127]        */
 /*     D6 - Print???                  */
+/*     D7 - ??? [1 arg]               */
 /*     D8 - ???                       */
 /*     D9 - ???                       */
 /*     DA - ???                       */
 /*     DB - ???                       */
+/*     DC - ??? [1 arg]               */
+/*     DD - ??? [1 arg]               */
+/*     DE - ??? [1 arg]               */
+/*     DF - ??? [1 arg]               */
 /*     E0 - Mod delay [?]             */
 /*     E1 - Tempo [0.65535]           */
 /*     E3 - Sweep?                    */
+/*     FB - ??? [no args]             */
 /*     FC - Loop end [marker?]        */
 /*     FD - Return                    */
 /*     FE - Track usage [16-bit]      */
 /*     FF - Fine                      */
 /**************************************/
-#define DEBUG
+#define LOG_OFF   (0)
+#define LOG_INFO  (1) //! per-file progress
+#define LOG_TRACE (2) //! per-track flow
+#ifndef LOG_MAX
+#define LOG_MAX   LOG_TRACE //! sites above this compile to nothing
+#endif
 /**************************************/
 #define CHNK_HAVE_DATA (0x01)
 #define CHNK_HAVE_LABL (0x02)
@@ -72,19 +113,56 @@
 /**************************************/
 #define BOOL_EQUAL(x,y) (((x)&(y)) == (y))
 /**************************************/
+#define INSN_NONE (0xFFFFFFFF) //! no instruction
+#define INSN_EOF  (0x100)      //! pseudo-command, bad code [CUR_* in arg0]
+#define INSN_LABEL  (0x01) //! command has a label
+#define INSN_LINKED (0x02) //! falls through elsewhere [Program_t::gLink]
+/**************************************/
+#define BUD_INSN_DEF  (0x01000000) //! commands per track
+#define BUD_TICK_DEF  (0xFFFFFFFF) //! ticks per track
+#define BUD_TRACK_DEF (0x04000000) //! output bytes per track
+#define BUD_FILE_DEF  (0x10000000) //! output bytes per file
+/**************************************/
+#define CALL_DEPTH (16)       //! call stack entries per track
+#define MEMO_BYTES (0x100000) //! memoized output per track
+#define MEMO_EVTS  (0x40000)  //! memoized events per track [-events]
+#define MEMO_DEST  (8)        //! memoized renderings per call target
+#define MEMO_MISS  (16)       //! calls in a row no rendering matched, then the target is dropped
+#define LOOP_NOTES (64)       //! note-offs a copied loop pass can carry
+/**************************************/
 #include <stdarg.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <vector>
 #include <string>
-#include <map>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <new>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define HAVE_MMAP
+#else
+#include <io.h>
+#include <fcntl.h>
+#endif
 #if defined(_MSC_VER) && _MSC_VER < 1900
 #define snprintf	_snprintf	// use _snprintf for Visual Studio 2013 and earlier
 #endif
 /**************************************/
 using namespace std;
 /**************************************/
+#include "rseq2midi.h"
+/**************************************/
 
 typedef   signed char      s8 ;
 typedef unsigned char      u8 ;
@@ -92,76 +170,556 @@ typedef   signed short     s16;
 typedef unsigned short     u16;
 typedef   signed int       s32;
 typedef unsigned int       u32;
+typedef unsigned long long u64;
 
 /**************************************/
-bool ignoreJumps = false;
-bool debugCtrls = false;
+
+//! conversion options
+typedef struct {
+	bool gIgnJump; //! ignore jump commands
+	bool gDbgCtrl; //! write debug controllers
+	bool gRunStat; //! use running status
+	bool gParTrk;  //! render tracks in parallel
+	bool gAnalyze; //! dump control flow instead of converting
+	bool gScan;    //! print what a conversion would find, write nothing
+	bool gEvents;  //! render to the event model, then serialize
+	bool gFormat0; //! merge every track into one [format 0]
+	bool gAllLab;  //! render every label to its own file
+	const char *gLabel; //! ... or just this one
+	u32  gJobs;    //! labels rendered at once, 0 = one per core
+	u8   gLogLvl;  //! LOG_*
+	u32  gLoops;   //! backward jumps taken per loop
+	
+	//! budgets, 0xFFFFFFFF is unlimited
+	u32  gMaxInsn; //! commands run per track
+	u32  gMaxTick; //! ticks per track
+	u32  gMaxTrkB; //! output bytes per track
+	u32  gMaxFilB; //! output bytes per file
+	
+	//! defaults: no options, budgets on
+	void Default(void) {
+		gIgnJump = false;
+		gDbgCtrl = false;
+		gRunStat = false;
+		gParTrk  = false;
+		gAnalyze = false;
+		gScan    = false;
+		gEvents  = false;
+		gFormat0 = false;
+		gAllLab  = false;
+		gLabel   = NULL;
+		gJobs    = 0;
+		gLogLvl  = LOG_OFF;
+		gLoops   = 0;
+		gMaxInsn = BUD_INSN_DEF;
+		gMaxTick = BUD_TICK_DEF;
+		gMaxTrkB = BUD_TRACK_DEF;
+		gMaxFilB = BUD_FILE_DEF;
+	}
+} Options_t;
+
+//! budget kinds
+enum {
+	BUD_NONE = 0,
+	BUD_INSN,
+	BUD_TICK,
+	BUD_TRACK,
+	BUD_FILE,
+};
+
 /**************************************/
 
 typedef struct {
 	u32 key; //! key
 	u32 pos; //! end [tick]
+	u32 seq; //! start order
 } Note_t;
 
 /**************************************/
 
-static inline u32 Swap32(u32 x) {
-	return (x>>24) | 
-	       ((x<<8) & 0x00FF0000) |
-	       ((x>>8) & 0x0000FF00) |
-	       (x<<24);
+static inline void PushBE(vector<u8> &v, u32 x, s32 b) {
+	for(s32 i=b-8;i>=0;i-=8) v.push_back(x >> i);
+}
+
+//! write midi-style delta
+static inline void PushVar(vector<u8> &v, u32 t) {
+	s32 c = 0;
+	u32 n = t;
+	
+	//! count bytes required
+	while(n > 127) {
+		c++;
+		n >>= 7;
+	}
+	
+	//! write individual data
+	for(int i=c;i>=0;i--) {
+		//! calculate value
+		u32 x = (t>>(7*i)) & 127;
+		if(i) x |= 0x80;
+		
+		//! push data to seq
+		v.push_back(x);
+	}
 }
 
-static inline u16 Swap16(u16 x) {
-	return (x>>8) | (x<<8);
+//! midi-style delta length
+static inline u32 VarLen(u32 t) {
+	u32 c = 1;
+	while(t > 127) {
+		c++;
+		t >>= 7;
+	}
+	return c;
 }
 
 /**************************************/
 
-static inline u32 ReadLE(FILE *f, u32 b) {
+//! track events as columns, one entry per SMF event
+//! ticks are absolute, the sum of the deltas an SMF would hold
+//! a channel event takes 7 bytes; payloads are only indexed for metas
+struct EventList_t {
+	vector<u32> gTick; //! position [tick]
+	vector<u8>  gKind; //! status with channel, FF for meta
+	vector<u8>  gD1;   //! data 1 / meta type
+	vector<u8>  gD2;   //! data 2
+	vector<u32> gMeta; //! meta events [index], ascending
+	vector<u32> gPay;  //! ... their payload [gPool offset]
+	vector<u8>  gPool; //! meta payloads, length [delta] + data
+	
+	void Clear(void) {
+		gTick.clear();
+		gKind.clear();
+		gD1.clear();
+		gD2.clear();
+		gMeta.clear();
+		gPay.clear();
+		gPool.clear();
+	}
+	
+	u32 Count(void) const {
+		return gTick.size();
+	}
+	
+	//! position after the first n events
+	u32 TickAt(u32 n) const {
+		return n ? gTick[n-1] : 0;
+	}
+	
+	//! metas before event n, the gPay index of the next one
+	u32 MetaAt(u32 n) const {
+		return lower_bound(gMeta.begin(), gMeta.end(), n) - gMeta.begin();
+	}
+	
+	void Push(u32 tick, u8 st, u8 d1, u8 d2) {
+		gTick.push_back(tick);
+		gKind.push_back(st);
+		gD1.push_back(d1);
+		gD2.push_back(d2);
+	}
+	
+	//! meta with its payload at pool offset pay
+	void PushMeta(u32 tick, u8 type, u32 pay) {
+		gMeta.push_back(Count());
+		gPay.push_back(pay);
+		Push(tick, 0xFF, type, 0);
+	}
+	
+	//! store payload, returns its offset
+	u32 PushPay(u32 len, const u8 *data) {
+		u32 off = gPool.size();
+		PushVar(gPool, len);
+		gPool.insert(gPool.end(), data, data + len);
+		return off;
+	}
+	
+	//! payload length with its prefix
+	u32 PaySize(u32 off) const {
+		u32 len = 0;
+		u32 i   = off;
+		do len = (len << 7) | (gPool[i] & 127); while(gPool[i++] & 0x80);
+		return (i - off) + len;
+	}
+	
+	//! append n events of src from 'from', shifted so that 'base'
+	//! in src lands on 'at'; src may be this list
+	void Append(const EventList_t &src, u32 from, u32 n, u32 base, u32 at) {
+		u32 cnt = Count() + n;
+		gTick.reserve(cnt); gKind.reserve(cnt);
+		gD1.reserve(cnt);   gD2.reserve(cnt);
+		
+		u32 meta = src.MetaAt(from);
+		for(u32 i=from;i<from+n;i++) {
+			u32 tick = src.gTick[i] - base + at;
+			if(src.gKind[i] != 0xFF) {
+				Push(tick, src.gKind[i], src.gD1[i], src.gD2[i]);
+				continue;
+			}
+			
+			//! payloads are shared within a list, copied across
+			u32 pay = src.gPay[meta++];
+			if(&src != this) {
+				u32 sz  = src.PaySize(pay);
+				u32 off = gPool.size();
+				gPool.insert(gPool.end(), src.gPool.begin() + pay, src.gPool.begin() + pay + sz);
+				pay = off;
+			}
+			PushMeta(tick, src.gD1[i], pay);
+		}
+	}
+	
+	//! true for the end of track meta
+	bool IsEnd(u32 i) const {
+		return gKind[i] == 0xFF && gD1[i] == 0x2F;
+	}
+	
+	//! encode event i without its delta, meta is its gPay index if it's
+	//! a meta and moves past it, last is the running status
+	void Put(vector<u8> &out, u32 i, u32 &meta, bool runStat, u8 &last) const {
+		u8 st = gKind[i];
+		if(st == 0xFF) {
+			//! FF type len, payload
+			u32 pay = gPay[meta++];
+			out.push_back(0xFF);
+			out.push_back(gD1[i]);
+			out.insert(out.end(), gPool.begin() + pay, gPool.begin() + pay + PaySize(pay));
+			last = 0;
+			return;
+		}
+		
+		//! status unless running, 1 data byte for program/pressure
+		u8 kind = st & 0xF0;
+		if(!runStat || st != last) out.push_back(st);
+		last = st;
+		out.push_back(gD1[i]);
+		if(kind != 0xC0 && kind != 0xD0) out.push_back(gD2[i]);
+	}
+	
+	//! encode as MTrk data, appended to out
+	void Serialize(vector<u8> &out, bool runStat) const {
+		u32 pos  = 0;
+		u32 meta = 0;
+		u8  last = 0;
+		for(u32 i=0;i<Count();i++) {
+			PushVar(out, gTick[i] - pos);
+			pos = gTick[i];
+			Put(out, i, meta, runStat, last);
+		}
+	}
+};
+
+/**************************************/
+
+//! input file, memory-mapped where possible, preloaded otherwise
+typedef struct {
+	const u8 *gBase; //! file data
+	u32       gSize; //! file length [bytes]
+	u8        gMapd; //! mapped (else heap)
+	
+	//! load from file, "-" is stdin
+	bool Open(const char *fn) {
+		bool stdIn = !strcmp(fn, "-");
+		gBase = NULL;
+		gSize = 0;
+		gMapd = 0;
+		
+#ifdef HAVE_MMAP
+		//! try to map regular files, stdin included when redirected
+		int fd = stdIn ? 0 : open(fn, O_RDONLY);
+		if(fd < 0) return false;
+		
+		struct stat st;
+		if(!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+			void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(p != MAP_FAILED) {
+				gBase = (const u8*)p;
+				gSize = st.st_size;
+				gMapd = 1;
+				if(!stdIn) close(fd);
+				return true;
+			}
+		}
+		if(!stdIn) close(fd);
+#endif
+		
+		//! pipe or unmappable, read it all
+		if(stdIn) {
+#ifdef _WIN32
+			_setmode(_fileno(stdin), _O_BINARY);
+#endif
+			return Load(stdin);
+		}
+		FILE *f = fopen(fn, "rb");
+		if(!f) return false;
+		bool ok = Load(f);
+		fclose(f);
+		return ok;
+	}
+	
+	//! preload from stream
+	bool Load(FILE *f) {
+		u8 *buf = NULL;
+		u32 cap = 0;
+		gSize = 0;
+		gMapd = 0;
+		
+		while(1) {
+			//! grow buffer
+			if(gSize == cap) {
+				cap = cap ? cap*2 : 0x10000;
+				u8 *n = (u8*)realloc(buf, cap);
+				if(!n) {
+					free(buf);
+					gBase = NULL;
+					gSize = 0;
+					return false;
+				} buf = n;
+			}
+			
+			//! fill it
+			size_t got = fread(buf + gSize, 1, cap - gSize, f);
+			if(!got) break;
+			gSize += got;
+		}
+		
+		gBase = buf;
+		return true;
+	}
+	
+	//! release data
+	void Close(void) {
+#ifdef HAVE_MMAP
+		if(gMapd) munmap((void*)gBase, gSize);
+		else
+#endif
+		free((void*)gBase);
+		
+		gBase = NULL;
+		gSize = 0;
+		gMapd = 0;
+	}
+} Input_t;
+
+/**************************************/
+
+//! cursor errors
+enum {
+	CUR_OK = 0,
+	CUR_TRUNC, //! read ran past the end
+	CUR_RANGE, //! address outside the buffer
+	CUR_TRACK, //! split to a track past 15 [decoder]
+	CUR_TEMPO, //! tempo 0 [decoder]
+};
+
+//! read cursor over an input buffer
+typedef struct {
+	const u8 *gBase; //! buffer
+	u32       gSize; //! buffer length
+	u32       gPos;  //! read position
+	u8        gErr;  //! first error [CUR_*], sticky
+	
+	//! attach to buffer
+	void Init(const u8 *base, u32 size) {
+		gBase = base;
+		gSize = size;
+		gPos  = 0;
+		gErr  = CUR_OK;
+	}
+	
+	//! position [offset]
+	u32 Tell(void) const {
+		return gPos;
+	}
+	
+	//! set position [offset]
+	void Seek(u32 pos) {
+		gPos = pos;
+	}
+	
+	//! fetch byte, EOF + CUR_TRUNC past the end
+	u32 Get(void) {
+		if(gPos < gSize) return gBase[gPos++];
+		if(!gErr) gErr = CUR_TRUNC;
+		return (u32)EOF;
+	}
+	
+	//! copy block, returns bytes read
+	u32 Read(void *dst, u32 len) {
+		u32 n = (gPos < gSize) ? gSize - gPos : 0;
+		if(n > len) n = len;
+		memcpy(dst, gBase + gPos, n);
+		gPos += n;
+		return n;
+	}
+	
+	//! block in place, len clipped to the end
+	const u8 *View(u32 &len) const {
+		u32 pos = (gPos < gSize) ? gPos : gSize;
+		if(len > gSize - pos) len = gSize - pos;
+		return gBase + pos;
+	}
+} Cursor_t;
+
+/**************************************/
+
+static inline u32 ReadLE(Cursor_t &f, u32 b) {
 	u32 v = 0;
-	for(u32 i=0;i<b;i+=8) v |= fgetc(f) << i;
+	for(u32 i=0;i<b;i+=8) v |= f.Get() << i;
 	return v;
 }
 
-static inline u32 ReadBE(FILE *f, s32 b) {
+static inline u32 ReadBE(Cursor_t &f, s32 b) {
 	u32 v = 0;
-	for(s32 i=b-8;i>=0;i-=8) v |= fgetc(f) << i;
+	for(s32 i=b-8;i>=0;i-=8) v |= f.Get() << i;
 	return v;
 }
 
 /**************************************/
 
-static inline u32 ReadVarLen(FILE *f) {
+static inline u32 ReadVarLen(Cursor_t &f) {
 	u32 t = 0;
 	while(1) {
-		u32 c = fgetc(f);
+		u32 c = f.Get();
 		t = (t<<7) | (c&127);
 		
-		if((c&0x80) == 0) break;
+		//! stop at end too, EOF has bit 7 set
+		if((c&0x80) == 0 || c == (u32)EOF) break;
 	} return t;
 }
 
 /**************************************/
 
-static inline void DebugMsg(const char *str, ...) {
-#ifdef DEBUG
-	static FILE *dstF = fopen("rseq2midi.log.txt", "wt");
+//! level-gated log call, arguments aren't evaluated when disabled
+#define LOG(lg, lvl, ...) \
+	do { if((lvl) <= LOG_MAX && (lg).gLevel >= (lvl)) (lg).Msg(__VA_ARGS__); } while(0)
+
+//! per-converter log, buffered, written to the shared sink in chunks
+typedef struct {
+	FILE  *gFile;  //! sink, owned by the caller
+	u8     gLevel; //! LOG_*
+	string gText;  //! pending text
+	mutex  gLock;  //! -p tracks log concurrently
 	
-	fseek(dstF, 0, SEEK_END);
-	va_list myList;
-	va_start(myList, str);
-	vfprintf(dstF, str, myList);
-	va_end(myList);
-#endif
-}
+	void Msg(const char *str, ...) {
+		char buf[0x200];
+		va_list myList;
+		va_start(myList, str);
+		vsnprintf(buf, sizeof(buf), str, myList);
+		va_end(myList);
+		
+		lock_guard<mutex> lock(gLock);
+		gText += buf;
+		if(gText.size() >= 0x10000) Write();
+	}
+	
+	//! hand pending text to the sink
+	void Flush(void) {
+		lock_guard<mutex> lock(gLock);
+		Write();
+	}
+	
+	//! one fwrite per chunk, so batch workers never split lines
+	void Write(void) {
+		if(gFile && !gText.empty()) fwrite(gText.data(), 1, gText.size(), gFile);
+		gText.clear();
+	}
+} Log_t;
 
 /**************************************/
 
-//! compare function for sorting note order
-static int NoteSortCmp(const void *a, const void *b) {
-	return ((Note_t*)a)->pos - ((Note_t*)b)->pos;
-}
+//! min-heap order for pending notes: end tick, then start order
+struct NoteLater {
+	bool operator()(const Note_t &a, const Note_t &b) const {
+		if(a.pos != b.pos) return a.pos > b.pos;
+		return a.seq > b.seq;
+	}
+};
+
+//! flush order on track end: notes pending at the last rest by end
+//! tick, then the ones started since in start order
+struct NoteFlushOrder {
+	u32 ord; //! first note started after the last rest
+	
+	bool operator()(const Note_t &a, const Note_t &b) const {
+		bool aNew = a.seq >= ord;
+		bool bNew = b.seq >= ord;
+		if(aNew != bNew) return bNew;
+		if(!aNew && a.pos != b.pos) return a.pos < b.pos;
+		return a.seq < b.seq;
+	}
+};
+
+/**************************************/
+
+//! rendered subroutine, spliced in again on an identical call
+typedef struct {
+	//! key: target + state on entry
+	u32 gDest;  //! target [insn]
+	u32 gWait;  //! pending delta
+	s8  gTrns;
+	u8  gLast;
+	u8  gRPNR;
+	u8  gDepth; //! call stack depth
+	
+	//! effect
+	u32 gOff;   //! output [sink memo store offset]
+	u32 gLen;   //! output length
+	u32 gMLen;  //! ... in sink units
+	u32 gTicks; //! position advance
+	u32 gCmds;  //! commands run
+	u32 gNSeq;  //! notes started
+	u32 gTmps;  //! tempo changes
+	u32 gXWait; //! state on return
+	s8  gXTrns;
+	u8  gXLast;
+	u8  gXRPNR;
+	u32 gPrev;  //! older rendering of the same target [gMemo] / INSN_NONE
+} Memo_t;
+
+//! renderings of one call target
+typedef struct {
+	u32 gHead;  //! newest [gMemo] / INSN_NONE
+	u8  gCount; //! renderings kept
+	u8  gMiss;  //! calls in a row none matched, MEMO_MISS = not memoized
+} MemoDest_t;
+
+//! call stack entry
+typedef struct {
+	u32    gRet;  //! return position [insn]
+	u8     gRec;  //! still memoizable
+	u32    gData; //! output length on entry
+	u32    gMark; //! sink position on entry
+	u32    gGPos; //! position on entry
+	u32    gNSeq; //! notes started on entry
+	u32    gTmps; //! tempo changes on entry
+	u32    gLeft; //! command budget on entry
+	Memo_t gMemo; //! key
+} Frame_t;
+
+//! backward jump taken under -loops, with the state at its last take
+typedef struct {
+	u32 gPos;   //! jump [offset]
+	u32 gHead;  //! target [offset]
+	u32 gTaken; //! times taken
+	u8  gHave;  //! snapshot below is valid
+	
+	//! snapshot
+	u32 gData;  //! output length
+	u32 gMark;  //! sink position
+	u32 gGPos;  //! position
+	u32 gNSeq;  //! notes started
+	u32 gNOrd;  //! ... since the last rest
+	u32 gTmps;  //! tempo changes
+	u32 gLeft;  //! command budget
+	u32 gSplt;  //! splits run
+	u32 gWait;
+	s8  gTrns;
+	u8  gLast;
+	u8  gRPNR;
+	u8  gCSP;
+	u32 gRet[CALL_DEPTH]; //! call stack
+	vector<Note_t> gNote; //! pending note-offs, relative to gGPos/gNSeq
+} Loop_t;
 
 /**************************************/
 
@@ -170,12 +728,32 @@ typedef struct {
 	u8             gStat; //! on/off
 	s8             gTrns; //! transpose
 	u8             gRPNR; //! RPNs ready
+	u8             gLast; //! running status
 	u32            gWait; //! waiting left
 	u32            gDPos; //! data position [offset]
 	u32            gGPos; //! global position [tick]
-	u32            gRPos; //! return position [offset]
-	vector<Note_t> gNote; //! notes
-	vector<u8>     gData; //! midi data
+	u32            gIP;   //! start position [insn]
+	Frame_t        gCall[CALL_DEPTH]; //! call stack
+	u8             gCSP;  //! call stack depth
+	u32            gNSeq; //! notes started
+	u32            gNOrd; //! notes started before last rest
+	vector<Note_t> gNote; //! pending note-offs [heap]
+	vector<u8>     gData; //! midi data [SmfSink_t]
+	u32            gSize; //! output length [CountSink_t, EventSink_t]
+	EventList_t    gEvnt; //! events [EventSink_t]
+	u32            gAcct; //! bytes counted against the file budget
+	u8             gOver; //! budget that stopped it [BUD_*]
+	vector<Memo_t> gMemo; //! rendered subroutines
+	vector<u8>     gMemoB; //! ... their output
+	EventList_t    gMemoE; //! ... or their events [EventSink_t]
+	unordered_map<u32, MemoDest_t> gMemoD; //! ... by target
+	vector<Loop_t> gLoop; //! backward jumps seen
+	u32            gSplt; //! splits run
+	u32            gTmps; //! tempo changes
+	u8             gHasL; //! ran a backward jump or loop marker
+	u32            gUnk[8]; //! unknown commands run [bitset]
+	const Options_t *gOpt; //! options
+	Log_t           *gLog; //! log sink
 	
 	//! reset track
 	void Reset(u32 idx) {
@@ -183,130 +761,367 @@ typedef struct {
 		gStat = 0;
 		gTrns = 0;
 		gRPNR = 0;
+		gLast = 0;
+		gWait = 0;
 		gDPos = 0;
 		gGPos = 0;
-		gRPos = 0;
+		gIP   = INSN_NONE;
+		gCSP  = 0;
+		gNSeq = 0;
+		gNOrd = 0;
+		gAcct = 0;
+		gOver = BUD_NONE;
 		gNote.clear();
 		gData.clear();
+		gEvnt.Clear();
+		gMemo.clear();
+		gMemoB.clear();
+		gMemoE.Clear();
+		gMemoD.clear();
+		gLoop.clear();
+		gSplt = 0;
+		gTmps = 0;
+		gHasL = 0;
+		gSize = 0;
+		memset(gUnk, 0, sizeof(gUnk));
 	}
 	
 	//! start track
-	void Start(u32 adr) {
+	void Start(u32 adr, u32 ip) {
 		//! init struct data
 		gStat = 1;
 		gTrns = 0;
+		gLast = 0;
 		gDPos = adr;
 		gGPos = 0;
-		gRPos = 0;
+		gIP   = ip;
+		gCSP  = 0;
+		gNSeq = 0;
+		gNOrd = 0;
+		gAcct = 0;
+		gOver = BUD_NONE;
 		gData.clear();
+		gEvnt.Clear();
 		gNote.clear();
+		gLoop.clear();
+		gSplt = 0;
+		gTmps = 0;
+		gSize = 0;
 		
 		//! debug stuff
-		DebugMsg("  Trk %02u started from 0x%X...\n", gIndx, adr);
+		LOG(*gLog, LOG_TRACE, "  Trk %02u started from 0x%X...\n", gIndx, adr);
 	}
 	
-	//! write midi-style delta
-	void PushDelta(u32 t) {
-		s32 c = 0;
-		u32 n = t;
-		
-		//! count bytes required
-		while(n > 127) {
-			c++;
-			n >>= 7;
+	//! call: splice in an earlier rendering, true if one fit
+	//! only without note-offs pending across the call
+	template<class S> bool Replay(u32 dest, u32 &left, u32 fileRoom) {
+		if(!gNote.empty()) return false;
+		
+		unordered_map<u32, MemoDest_t>::iterator d = gMemoD.find(dest);
+		if(d == gMemoD.end() || d->second.gMiss >= MEMO_MISS) return false;
+		
+		for(u32 i=d->second.gHead;i!=INSN_NONE;i=gMemo[i].gPrev) {
+			const Memo_t &m = gMemo[i];
+			if(m.gWait != gWait || m.gTrns != gTrns ||
+			   m.gLast != gLast || m.gRPNR != gRPNR || m.gDepth != gCSP) continue;
+			
+			//! budget would run out inside, leave it to the interpreter
+			if(m.gCmds > left) return false;
+			if((u64)gGPos + m.gTicks > gOpt->gMaxTick) return false;
+			if((u64)S::Size(*this) + m.gLen > gOpt->gMaxTrkB) return false;
+			if(m.gLen > fileRoom) return false;
+			
+			S::Splice(*this, m.gOff, m.gMLen, m.gLen);
+			gGPos += m.gTicks;
+			gNSeq += m.gNSeq;
+			gTmps += m.gTmps;
+			gWait  = m.gXWait;
+			gTrns  = m.gXTrns;
+			gLast  = m.gXLast;
+			gRPNR  = m.gXRPNR;
+			left  -= m.gCmds;
+			d->second.gMiss = 0;
+			return true;
+		}
+		
+		//! state keeps changing between calls, stop keeping renderings
+		d->second.gMiss++;
+		return false;
+	}
+	
+	//! call: push return position, a full stack drops the innermost
+	template<class S> void Call(u32 dest, u32 ret, u32 left) {
+		if(gCSP == CALL_DEPTH) gCSP--;
+		
+		Frame_t &f = gCall[gCSP];
+		f.gRet  = ret;
+		f.gRec  = gNote.empty();
+		f.gData = S::Size(*this);
+		f.gMark = S::Mark(*this);
+		f.gGPos = gGPos;
+		f.gNSeq = gNSeq;
+		f.gTmps = gTmps;
+		f.gLeft = left;
+		f.gMemo.gDest  = dest;
+		f.gMemo.gWait  = gWait;
+		f.gMemo.gTrns  = gTrns;
+		f.gMemo.gLast  = gLast;
+		f.gMemo.gRPNR  = gRPNR;
+		f.gMemo.gDepth = gCSP;
+		gCSP++;
+	}
+	
+	//! return: pop return position, memoize the rendering when clean
+	template<class S> u32 Return(u32 left) {
+		Frame_t &f = gCall[--gCSP];
+		u32 len = S::Size(*this) - f.gData;
+		if(f.gRec && gNote.empty()) {
+			MemoDest_t &d = gMemoD.insert(make_pair(f.gMemo.gDest, MemoDest_t{INSN_NONE, 0, 0})).first->second;
+			if(d.gCount >= MEMO_DEST || d.gMiss >= MEMO_MISS) return f.gRet;
+			
+			Memo_t m = f.gMemo;
+			m.gLen   = len;
+			m.gMLen  = S::Mark(*this) - f.gMark;
+			m.gTicks = gGPos - f.gGPos;
+			m.gCmds  = f.gLeft - left;
+			m.gNSeq  = gNSeq - f.gNSeq;
+			m.gTmps  = gTmps - f.gTmps;
+			m.gXWait = gWait;
+			m.gXTrns = gTrns;
+			m.gXLast = gLast;
+			m.gXRPNR = gRPNR;
+			m.gPrev  = d.gHead;
+			if(S::Keep(*this, f.gMark, m.gMLen, m.gOff)) {
+				d.gHead = gMemo.size();
+				d.gCount++;
+				gMemo.push_back(m);
+			}
+		}
+		return f.gRet;
+	}
+	
+	//! side effect outside the output, no open call can be memoized
+	void NoMemo(void) {
+		for(u32 i=0;i<gCSP;i++) gCall[i].gRec = 0;
+	}
+	
+	//! backward jump: taken while -loops allows, loops nested in its
+	//! body start over on every pass, any other loop saw its state change
+	bool LoopTake(u32 pos, u32 head) {
+		if(!gOpt->gLoops) return false;
+		
+		Loop_t *l = LoopFind(pos);
+		if(!l) {
+			gLoop.push_back(Loop_t());
+			l = &gLoop.back();
+			l->gPos   = pos;
+			l->gHead  = head;
+			l->gTaken = 0;
+			l->gHave  = 0;
+		}
+		if(l->gTaken >= gOpt->gLoops) return false;
+		l->gTaken++;
+		
+		for(u32 n=0;n<gLoop.size();n++) {
+			Loop_t &m = gLoop[n];
+			if(m.gPos >= head && m.gPos < pos) m.gTaken = m.gHave = 0;
+			else if(&m != l && (pos < m.gHead || pos >= m.gPos)) m.gHave = 0;
 		}
+		return true;
+	}
+	
+	Loop_t *LoopFind(u32 pos) {
+		for(u32 n=0;n<gLoop.size();n++)
+			if(gLoop[n].gPos == pos) return &gLoop[n];
+		return NULL;
+	}
+	
+	//! backward jump taken: a pass that ended in the state it started
+	//! from renders the same bytes every time, so the remaining takes
+	//! are copies of it with positions shifted at each seam
+	template<class S> void LoopSeam(u32 pos, u32 &left, u32 fileRoom) {
+		Loop_t &l = *LoopFind(pos);
 		
-		//! write individual data
-		for(int i=c;i>=0;i--) {
-			//! calculate value
-			u32 v = (t>>(7*i)) & 127;
-			if(i) v |= 0x80;
+		if(l.gHave && LoopSame(l)) {
+			u32 len   = S::Size(*this) - l.gData;
+			u32 mlen  = S::Mark(*this) - l.gMark;
+			u32 ticks = gGPos - l.gGPos;
+			u32 cmds  = l.gLeft - left;
+			u32 seqs  = gNSeq - l.gNSeq;
+			u32 tmps  = gTmps - l.gTmps;
+			u32 k     = gOpt->gLoops - l.gTaken;
+			
+			//! stop short of the budgets, the interpreter finds the exact spot
+			if(k > left / cmds) k = left / cmds;
+			if(ticks) {
+				u32 room = gGPos < gOpt->gMaxTick ? gOpt->gMaxTick - gGPos : 0;
+				if(k > room / ticks) k = room / ticks;
+			}
+			u32 size = S::Size(*this);
+			u32 room = size < gOpt->gMaxTrkB ? gOpt->gMaxTrkB - size : 0;
+			if(room > fileRoom) room = fileRoom;
+			if(k > room / len) k = room / len;
 			
-			//! push data to seq
-			gData.push_back(v);
+			if(k) {
+				S::Repeat(*this, l.gMark, mlen, len, k);
+				
+				for(u32 n=0;n<gNote.size();n++) {
+					gNote[n].pos += k*ticks;
+					gNote[n].seq += k*seqs;
+				}
+				gGPos    += k*ticks;
+				gNSeq    += k*seqs;
+				gNOrd    += k*seqs;
+				gTmps    += k*tmps;
+				left     -= k*cmds;
+				l.gTaken += k;
+				
+				LOG(*gLog, LOG_TRACE, "  Trk %02u: Loop at 0x%X copied %u times\n", gIndx, pos, k);
+			}
+		}
+		LoopSnap(l, S::Size(*this), S::Mark(*this), left);
+	}
+	
+	//! state that decides what the next pass renders
+	void LoopSnap(Loop_t &l, u32 size, u32 mark, u32 left) {
+		l.gHave = gNote.size() <= LOOP_NOTES;
+		if(!l.gHave) return;
+		
+		l.gData = size;
+		l.gMark = mark;
+		l.gGPos = gGPos;
+		l.gNSeq = gNSeq;
+		l.gNOrd = gNOrd;
+		l.gTmps = gTmps;
+		l.gLeft = left;
+		l.gSplt = gSplt;
+		l.gWait = gWait;
+		l.gTrns = gTrns;
+		l.gLast = gLast;
+		l.gRPNR = gRPNR;
+		l.gCSP  = gCSP;
+		for(u32 n=0;n<gCSP;n++) l.gRet[n] = gCall[n].gRet;
+		l.gNote = gNote;
+		for(u32 n=0;n<gNote.size();n++) {
+			l.gNote[n].pos -= gGPos;
+			l.gNote[n].seq -= gNSeq;
+		}
+	}
+	
+	bool LoopSame(const Loop_t &l) {
+		//! a split restarts another track, that has to happen every pass
+		if(l.gSplt != gSplt) return false;
+		if(l.gWait != gWait || l.gTrns != gTrns || l.gLast != gLast ||
+		   l.gRPNR != gRPNR || l.gCSP != gCSP) return false;
+		if(l.gNSeq - l.gNOrd != gNSeq - gNOrd) return false;
+		for(u32 n=0;n<gCSP;n++)
+			if(l.gRet[n] != gCall[n].gRet) return false;
+		
+		if(l.gNote.size() != gNote.size()) return false;
+		for(u32 n=0;n<gNote.size();n++) {
+			const Note_t &a = l.gNote[n];
+			const Note_t &b = gNote[n];
+			if(a.key != b.key || a.pos != b.pos - gGPos || a.seq != b.seq - gNSeq) return false;
 		}
+		return true;
 	}
 	
-	//! process delta
-	void ProcDelta(void) {
-		PushDelta(gWait);
+	//! take pending delta
+	u32 Delta(void) {
+		u32 t = gWait;
 		gWait = 0;
+		return t;
 	}
 	
-	//! write event to seq
-	void Event(u32 ev, u32 argc, const u8 *argv) {
-		//! process delta
-		ProcDelta();
+	//! true if status can be dropped under running status
+	bool Status(u8 st) {
+		bool run = gOpt->gRunStat && st == gLast;
 		
-		//! push back command + arguments
-		gData.push_back(ev|gIndx);
-		while(argc--) gData.push_back(*argv++);
+		//! meta events cancel running status
+		gLast = (st < 0xF0) ? st : 0;
+		return run;
+	}
+	
+	//! write event to seq
+	template<class S> void Event(u32 ev, u32 argc, const u8 *argv) {
+		//! process delta, push back command + arguments
+		u32 t = Delta();
+		u8 st = ev|gIndx;
+		S::Event(*this, t, st, Status(st), argc, argv);
+	}
+	
+	//! note-off, t ticks after the last event
+	template<class S> void NoteOff(u32 t, u8 key) {
+		const u8 edata[] = {key, 0};
+		u8 st = 0x90|gIndx;
+		S::Event(*this, t, st, Status(st), 2, edata);
 	}
 	
 	//! note-on
-	void mNoteOn(u32 key, u32 vel, u32 time) {
+	template<class S> void mNoteOn(u32 key, u32 vel, u32 time) {
 		//! write data
-		//Event(0x90, 2, (const u8[]) {key, vel});
-		const u8 edata[] = {key, vel};
-		Event(0x90, 2, edata);
+		//Event(0x90, 2, (const u8[]) {(u8)key, (u8)vel});
+		const u8 edata[] = {(u8)key, (u8)vel};
+		Event<S>(0x90, 2, edata);
 		
-		//! push note into stack
-		Note_t note = {key, gGPos + time};
+		//! push note into heap
+		Note_t note = {key, gGPos + time, gNSeq++};
 		gNote.push_back(note);
+		push_heap(gNote.begin(), gNote.end(), NoteLater());
 	}
 	
 	//! set panning
-	void mGenCtrl(u8 ctrlType, u8 ctrlData) {
+	template<class S> void mGenCtrl(u8 ctrlType, u8 ctrlData) {
 		//! write data
 		const u8 edata[] = {ctrlType, ctrlData};
-		Event(0xB0, 2, edata);
+		Event<S>(0xB0, 2, edata);
 	}
 	
 	//! set volume
-	void mVol(u32 vol) {
+	template<class S> void mVol(u32 vol) {
 		//! write data
-		//Event(0xB0, 2, (const u8[]) {0x07, vol});
-		const u8 edata[] = {0x07, vol};
-		Event(0xB0, 2, edata);
+		//Event(0xB0, 2, (const u8[]) {0x07, (u8)vol});
+		const u8 edata[] = {0x07, (u8)vol};
+		Event<S>(0xB0, 2, edata);
 	}
 	
 	//! set panning
-	void mPan(u32 pan) {
+	template<class S> void mPan(u32 pan) {
 		//! write data
-		//Event(0xB0, 2, (const u8[]) {0x0A, pan});
-		const u8 edata[] = {0x0A, pan};
-		Event(0xB0, 2, edata);
+		//Event(0xB0, 2, (const u8[]) {0x0A, (u8)pan});
+		const u8 edata[] = {0x0A, (u8)pan};
+		Event<S>(0xB0, 2, edata);
 	}
 	
 	//! set expression
-	void mExp(u32 exp) {
+	template<class S> void mExp(u32 exp) {
 		//! write data
-		//Event(0xB0, 2, (const u8[]) {0x0B, exp});
-		const u8 edata[] = {0x0B, exp};
-		Event(0xB0, 2, edata);
+		//Event(0xB0, 2, (const u8[]) {0x0B, (u8)exp});
+		const u8 edata[] = {0x0B, (u8)exp};
+		Event<S>(0xB0, 2, edata);
 	}
 	
 	//! set program
-	void mPrg(u32 prg) {
+	template<class S> void mPrg(u32 prg) {
 		//! write data
 		//Event(0xC0, 1, (const u8[]) {prg});
-		const u8 edata[] = {prg};
-		Event(0xC0, 1, edata);
+		const u8 edata[] = {(u8)prg};
+		Event<S>(0xC0, 1, edata);
 	}
 	
 	//! set bend amount
-	void mBnd(u32 bnd) {
+	template<class S> void mBnd(u32 bnd) {
 		//! scale 
 		u32 n = 0x2000 + bnd*16384/256;
 		
 		//! write data
-		//Event(0xE0, 2, (const u8[]) {n&127, n>>7});
-		const u8 edata[] = {n&127, n>>7};
-		Event(0xE0, 2, edata);
+		//Event(0xE0, 2, (const u8[]) {(u8)(n&127), (u8)(n>>7)});
+		const u8 edata[] = {(u8)(n&127), (u8)(n>>7)};
+		Event<S>(0xE0, 2, edata);
 	}
 	
 	//! set bend range
-	void mBndRng(u32 rng) {
+	template<class S> void mBndRng(u32 rng) {
 		//! RPNs ready?
 		if(!gRPNR) {
 			//! no, write them
@@ -315,120 +1130,106 @@ typedef struct {
 			//Event(0xB0, 2, (const u8[]) {0x65, 0}); //! high
 			const u8 edata2[] = {0x65, 0};
 			const u8 edata1[] = {0x64, 0};
-			Event(0xB0, 2, edata2); //! high
-			Event(0xB0, 2, edata1); //! low
+			Event<S>(0xB0, 2, edata2); //! high
+			Event<S>(0xB0, 2, edata1); //! low
 		}
 		
 		//! write data
-		//Event(0xB0, 2, (const u8[]) {0x06, rng});
-		const u8 edata[] = {0x06, rng};
-		Event(0xB0, 2, edata);
+		//Event(0xB0, 2, (const u8[]) {0x06, (u8)rng});
+		const u8 edata[] = {0x06, (u8)rng};
+		Event<S>(0xB0, 2, edata);
 	}
 	
 	//! write RPN controller
-	void mRPN(u8 msb, u8 lsb, u32 data) {
+	template<class S> void mRPN(u8 msb, u8 lsb, u32 data) {
 		const u8 edata2[] = {0x65, lsb};
 		const u8 edata1[] = {0x64, msb};
-		Event(0xB0, 2, edata2); //! high
-		Event(0xB0, 2, edata1); //! low
+		Event<S>(0xB0, 2, edata2); //! high
+		Event<S>(0xB0, 2, edata1); //! low
 		
 		//! write data
-		const u8 edata[] = {0x06, data};
-		Event(0xB0, 2, edata);
+		const u8 edata[] = {0x06, (u8)data};
+		Event<S>(0xB0, 2, edata);
 		
 		gRPNR = 0;
 	}
 	
 	//! write NRPN controller
-	void mNRPN(u8 msb, u8 lsb, u32 data) {
+	template<class S> void mNRPN(u8 msb, u8 lsb, u32 data) {
 		const u8 edata2[] = {0x63, lsb};
 		const u8 edata1[] = {0x62, msb};
-		Event(0xB0, 2, edata2); //! high
-		Event(0xB0, 2, edata1); //! low
+		Event<S>(0xB0, 2, edata2); //! high
+		Event<S>(0xB0, 2, edata1); //! low
 		
 		//! write data
-		const u8 edata[] = {0x06, data};
-		Event(0xB0, 2, edata);
+		const u8 edata[] = {0x06, (u8)data};
+		Event<S>(0xB0, 2, edata);
 		
 		gRPNR = 0;
 	}
 	
 	//! set tempo
-	void mTmp(u32 tmp) {
+	template<class S> void mTmp(u32 tmp) {
 		//! calculate ms per quarter note
 		u32 n = 60000000 / tmp;
+		gTmps++;
 		
 		//! write data
-		//Event(0xFF, 5, (const u8[]) {0x51, 3, n>>16, n>>8, n>>0});
-		const u8 edata[] = {0x51, 3, n>>16, n>>8, n>>0};
-		Event(0xFF, 5, edata);
+		//Event(0xFF, 5, (const u8[]) {0x51, 3, (u8)(n>>16), (u8)(n>>8), (u8)(n>>0)});
+		const u8 edata[] = {0x51, 3, (u8)(n>>16), (u8)(n>>8), (u8)(n>>0)};
+		Event<S>(0xFF, 5, edata);
 	}
 	
-	//! set tempo
-	void mMetaEvent(u8 type, u32 len, const u8* data) {
+	//! write meta event with a payload
+	template<class S> void mMetaEvent(u8 type, u32 len, const u8* data) {
 		//! write data
-		Event(0xFF, 1, &type);
-		PushDelta(len);
-		while(len--) gData.push_back(*data++);
+		u32 t = Delta();
+		Status(0xFF);
+		S::Meta(*this, t, type, len, data);
 	}
 	
 	//! kill track
-	void mEnd(void) {
+	template<class S> void mEnd(void) {
 		//! flush all running notes
+		NoteFlushOrder order = {gNOrd};
+		sort(gNote.begin(), gNote.end(), order);
 		for(u32 i=0;i<gNote.size();i++) {
-			//! fetch pointer to note
-			Note_t &note = gNote[i];
-			
-			//! push delta
-			PushDelta(gWait);
-			gWait = 0;
-			
-			//! push note-off
-			gData.push_back(0x90|gIndx);
-			gData.push_back(note.key  );
-			gData.push_back(0         );
+			//! push delta + note-off
+			NoteOff<S>(Delta(), gNote[i].key);
 		}
 		gNote.clear();
 		
 		//! send kill command
 		//Event(0xFF, 2, (const u8[]) {0x2F,0});
 		const u8 edata[] = {0x2F,0};
-		Event(0xFF, 2, edata);
+		Event<S>(0xFF, 2, edata);
 		
 		//! turn off
 		gStat = 0;
 	}
 	
 	//! wait n ticks
-	void Wait(u32 timeLeft) {
-		//! sort notes
-		if(u32 len = gNote.size()) qsort(&gNote[0], len, sizeof(Note_t), NoteSortCmp);
+	template<class S> void Wait(u32 timeLeft) {
+		//! everything pending now counts as sorted
+		gNOrd = gNSeq;
 		
 		//! final position after this
 		u32 pPos = gGPos + timeLeft;
 		
-		//! process notes from front
-		for(u32 i=0;i<gNote.size();i++) {
+		//! process notes ending in time, earliest first
+		while(!gNote.empty() && gNote.front().pos <= pPos) {
 			//! fetch pointer to note
-			Note_t &note = gNote[i];
-			
-			//! doesn't end this tick?
-			if(note.pos > pPos) continue;
+			const Note_t &note = gNote.front();
 			
 			//! take time until note ends
 			u32 dif = note.pos - gGPos;
 			
-			//! push a delta that long
-			PushDelta(dif);
-			
-			//! push note-off
-			gData.push_back(0x90|gIndx);
-			gData.push_back(note.key  );
-			gData.push_back(0         );
+			//! push a delta that long + note-off
+			NoteOff<S>(dif, note.key);
 			
 			//! destroy note
-			gNote.erase(gNote.begin() + i);
-			i--;
+			pop_heap(gNote.begin(), gNote.end(), NoteLater());
+			gNote.pop_back();
 			
 			//! set new position
 			gGPos    += dif;
@@ -443,6 +1244,156 @@ typedef struct {
 
 /**************************************/
 
+//! event sinks: where a track's output goes, picked at compile time
+//! the runners below are instantiated once per sink, so the hot loop
+//! never asks which one it writes to; every sink keeps Size equal to
+//! the SMF length, the budgets depend on it
+//! Mark is the sink's own position, memo + loop copies are taken
+//! from there: output bytes, events, or nothing to copy
+
+//! SMF bytes, into gData
+struct SmfSink_t {
+	static inline void Byte(Track_t &trk, u8 b) {
+		trk.gData.push_back(b);
+	}
+	
+	//! write midi-style delta
+	static inline void Delta(Track_t &trk, u32 t) {
+		PushVar(trk.gData, t);
+	}
+	
+	//! delta, status unless running, arguments
+	static inline void Event(Track_t &trk, u32 t, u8 st, bool run, u32 argc, const u8 *argv) {
+		Delta(trk, t);
+		if(!run) Byte(trk, st);
+		while(argc--) Byte(trk, *argv++);
+	}
+	
+	//! delta, FF type len, payload
+	static inline void Meta(Track_t &trk, u32 t, u8 type, u32 len, const u8 *data) {
+		Delta(trk, t);
+		Byte(trk, 0xFF);
+		Byte(trk, type);
+		Delta(trk, len);
+		trk.gData.insert(trk.gData.end(), data, data + len);
+	}
+	
+	static inline u32 Size(const Track_t &trk) {
+		return trk.gData.size();
+	}
+	
+	static inline u32 Mark(const Track_t &trk) {
+		return trk.gData.size();
+	}
+	
+	//! memoized output [gMemoB] spliced in again
+	static inline void Splice(Track_t &trk, u32 off, u32 len, u32) {
+		trk.gData.insert(trk.gData.end(), trk.gMemoB.begin() + off, trk.gMemoB.begin() + off + len);
+	}
+	
+	//! output from 'from' on memoized at off, false if it doesn't fit
+	static inline bool Keep(Track_t &trk, u32 from, u32 len, u32 &off) {
+		if(trk.gMemoB.size() + len > MEMO_BYTES) return false;
+		off = trk.gMemoB.size();
+		trk.gMemoB.insert(trk.gMemoB.end(), trk.gData.begin() + from, trk.gData.end());
+		return true;
+	}
+	
+	//! loop pass at 'from' appended k more times
+	static inline void Repeat(Track_t &trk, u32 from, u32 len, u32, u32 k) {
+		vector<u8> &data = trk.gData;
+		u32 at = data.size();
+		data.resize(at + k*len);
+		for(u32 n=0;n<k;n++) memcpy(&data[at + n*len], &data[from], len);
+	}
+};
+
+//! length only, into gSize (-scan)
+struct CountSink_t {
+	static inline void Event(Track_t &trk, u32 t, u8, bool run, u32 argc, const u8*) {
+		trk.gSize += VarLen(t) + !run + argc;
+	}
+	
+	static inline void Meta(Track_t &trk, u32 t, u8, u32 len, const u8*) {
+		trk.gSize += VarLen(t) + 2 + VarLen(len) + len;
+	}
+	
+	static inline u32 Size(const Track_t &trk) {
+		return trk.gSize;
+	}
+	
+	static inline u32 Mark(const Track_t&) {
+		return 0;
+	}
+	
+	//! nothing to copy, memos are free
+	static inline void Splice(Track_t &trk, u32, u32, u32 len) {
+		trk.gSize += len;
+	}
+	
+	static inline bool Keep(Track_t&, u32, u32, u32 &off) {
+		off = 0;
+		return true;
+	}
+	
+	static inline void Repeat(Track_t &trk, u32, u32, u32 len, u32 k) {
+		trk.gSize += k*len;
+	}
+};
+
+//! columns, into gEvnt (-events), gSize counts as CountSink_t does
+//! running status is left to Serialize, it follows from the statuses
+struct EventSink_t {
+	static inline void Event(Track_t &trk, u32 t, u8 st, bool run, u32 argc, const u8 *argv) {
+		EventList_t &ev = trk.gEvnt;
+		u32 tick = ev.TickAt(ev.Count()) + t;
+		trk.gSize += VarLen(t) + !run + argc;
+		
+		//! FF type len ... from Event() is a meta with a short payload
+		if(st >= 0xF0) ev.PushMeta(tick, argv[0], ev.PushPay(argv[1], argv + 2));
+		else           ev.Push(tick, st, argv[0], (argc > 1) ? argv[1] : 0);
+	}
+	
+	static inline void Meta(Track_t &trk, u32 t, u8 type, u32 len, const u8 *data) {
+		EventList_t &ev = trk.gEvnt;
+		u32 tick = ev.TickAt(ev.Count()) + t;
+		trk.gSize += VarLen(t) + 2 + VarLen(len) + len;
+		ev.PushMeta(tick, type, ev.PushPay(len, data));
+	}
+	
+	static inline u32 Size(const Track_t &trk) {
+		return trk.gSize;
+	}
+	
+	static inline u32 Mark(const Track_t &trk) {
+		return trk.gEvnt.Count();
+	}
+	
+	//! memoized events [gMemoE] appended at the current position
+	static inline void Splice(Track_t &trk, u32 off, u32 n, u32 len) {
+		EventList_t &ev = trk.gEvnt;
+		ev.Append(trk.gMemoE, off, n, 0, ev.TickAt(ev.Count()));
+		trk.gSize += len;
+	}
+	
+	//! each memo is kept relative to its own start, not to the one before
+	static inline bool Keep(Track_t &trk, u32 from, u32 n, u32 &off) {
+		if(trk.gMemoE.Count() + n > MEMO_EVTS) return false;
+		off = trk.gMemoE.Count();
+		trk.gMemoE.Append(trk.gEvnt, from, n, trk.gEvnt.TickAt(from), 0);
+		return true;
+	}
+	
+	//! loop pass at 'from' appended k more times, each a pass later
+	static inline void Repeat(Track_t &trk, u32 from, u32 n, u32 len, u32 k) {
+		EventList_t &ev = trk.gEvnt;
+		for(u32 i=0;i<k;i++) ev.Append(ev, from, n, ev.TickAt(from), ev.TickAt(ev.Count()));
+		trk.gSize += k*len;
+	}
+};
+
+/**************************************/
+
 typedef struct {
 	u32 id;     //! chunk ID
 	u32 magic;  //! magic [0xFEFF0100]
@@ -460,6 +1411,7 @@ typedef struct {
 	u32 offset; //! seq data offset
 	
 	u32 fOff;   //! first track offset
+	u32 fEnd;   //! end of chunk [absolute]
 } DATAHead_t;
 
 /**************************************/
@@ -474,30 +1426,736 @@ typedef struct {
 
 /**************************************/
 
-typedef std::map<u32, std::string> rseq_label_t;
+//! label, text viewed in place in the input
+typedef struct {
+	u32       pos;  //! command [DATA offset]
+	u32       len;  //! text length
+	const u8 *text; //! text, not terminated
+} rseq_label_entry_t;
+
+//! labels sorted by position, one per position
+typedef std::vector<rseq_label_entry_t> rseq_label_t;
 
 /**************************************/
 
-static struct {
-	//! state
-	u32 gStat;
-	
-	//! RSEQ chunk header
-	RSEQHead_t gRSEQHead;
-	
-	//! DATA chunk header
-	DATAHead_t gDATAHead;
-	
-	//! DATA chunk header
-	LABLHead_t gLABLHead;
-	
-	//! RSEQ tracks
-	Track_t gTrack[16];
-	
-	//! Label Data
-	rseq_label_t gLabels;
-	
-	//! reset all
+//! command argument layouts
+enum {
+	ARG_NONE,  //! no arguments
+	ARG_U8,    //! 1 byte
+	ARG_U16,   //! 16-bit
+	ARG_VAR,   //! variable length
+	ARG_NOTE,  //! velocity, variable length
+	ARG_PRG,   //! program + optional bank bytes
+	ARG_SPLIT, //! track, 24-bit address
+	ARG_ADR,   //! 24-bit address
+};
+
+//! command MIDI mappings
+enum {
+	MAP_UNKNOWN, //! not known, warn
+	MAP_FLOW,    //! split/jump/call/return/end
+	MAP_NOTE,    //! note-on
+	MAP_WAIT,    //! rest
+	MAP_PRG,     //! program change
+	MAP_CTRL,    //! controller P0 <- argument & P1
+	MAP_MARK,    //! controller P0 <- P1
+	MAP_NRPN,    //! NRPN P0:P1 <- argument
+	MAP_BEND,    //! pitch bend
+	MAP_BNDRNG,  //! bend range RPN
+	MAP_TEMPO,   //! tempo meta event
+	MAP_DEBUG,   //! controller 0x70 <- command, P0 <- argument (if P0)
+	MAP_COUNT
+};
+
+//! command descriptor
+typedef struct {
+	u8 gArgs; //! argument layout
+	u8 gMap;  //! MIDI mapping
+	u8 gP0;   //! mapping parameter
+	u8 gP1;   //! mapping parameter
+	u8 gDbg;  //! only mapped with -d
+} CmdDesc_t;
+
+#define C_NOTE          {ARG_NOTE,  MAP_NOTE,    0,    0,    0}
+#define C_UNK           {ARG_NONE,  MAP_UNKNOWN, 0,    0,    0}
+#define C_FLOW(a)       {a,         MAP_FLOW,    0,    0,    0}
+#define C_CTRL(c)       {ARG_U8,    MAP_CTRL,    c,    0xFF, 0}
+#define C_DCTRL(c)      {ARG_U8,    MAP_CTRL,    c,    0xFF, 1}
+#define C_DBG(a,c)      {a,         MAP_DEBUG,   c,    0,    1}
+#define C_NOTE8         C_NOTE, C_NOTE, C_NOTE, C_NOTE, C_NOTE, C_NOTE, C_NOTE, C_NOTE
+#define C_UNK8          C_UNK,  C_UNK,  C_UNK,  C_UNK,  C_UNK,  C_UNK,  C_UNK,  C_UNK
+
+//! every command byte, plus INSN_EOF
+static constexpr CmdDesc_t gCmdDesc[0x101] = {
+	/* 00-7F */ C_NOTE8, C_NOTE8, C_NOTE8, C_NOTE8, C_NOTE8, C_NOTE8, C_NOTE8, C_NOTE8,
+	            C_NOTE8, C_NOTE8, C_NOTE8, C_NOTE8, C_NOTE8, C_NOTE8, C_NOTE8, C_NOTE8,
+	/* 80 */ {ARG_VAR, MAP_WAIT, 0, 0, 0},
+	/* 81 */ {ARG_PRG, MAP_PRG,  0, 0, 0},
+	/* 82-87 */ C_UNK, C_UNK, C_UNK, C_UNK, C_UNK, C_UNK,
+	/* 88 */ C_FLOW(ARG_SPLIT),
+	/* 89 */ C_FLOW(ARG_ADR),
+	/* 8A */ C_FLOW(ARG_ADR),
+	/* 8B-8F */ C_UNK, C_UNK, C_UNK, C_UNK, C_UNK,
+	/* 90-AF */ C_UNK8, C_UNK8, C_UNK8, C_UNK8,
+	/* B0 */ C_DBG(ARG_U8, 0x26),
+	/* B1-B5 */ C_DBG(ARG_U8, 0x26), C_DBG(ARG_U8, 0x26), C_DBG(ARG_U8, 0x26), C_DBG(ARG_U8, 0x26), C_DBG(ARG_U8, 0x26),
+	/* B6-BF */ C_UNK, C_UNK, C_UNK8,
+	/* C0 */ C_CTRL(0x0A),
+	/* C1 */ C_CTRL(0x07),
+	/* C2 */ C_CTRL(0x27),
+	/* C3 */ {ARG_U8, MAP_NRPN, 0x00, 0x02, 0},
+	/* C4 */ {ARG_U8, MAP_BEND, 0, 0, 0},
+	/* C5 */ {ARG_U8, MAP_BNDRNG, 0, 0, 0},
+	/* C6 */ C_DBG(ARG_U8, 0x26),
+	/* C7 */ C_DBG(ARG_U8, 0x26),
+	/* C8 */ C_DBG(ARG_U8, 0x26),
+	/* C9 */ C_CTRL(84),
+	/* CA */ C_CTRL(1),
+	/* CB */ C_DCTRL(0x11),
+	/* CC */ C_DCTRL(0x21),
+	/* CD */ C_DCTRL(0x12),
+	/* CE */ C_CTRL(65),
+	/* CF */ C_CTRL(5),
+	/* D0 */ C_DCTRL(73),
+	/* D1 */ {ARG_U8, MAP_NRPN, 0x01, 0x64, 1},
+	/* D2 */ C_DCTRL(91),
+	/* D3 */ C_DCTRL(72),
+	/* D4 */ {ARG_NONE, MAP_MARK, 0x6F, 0, 0},
+	/* D5 */ C_CTRL(0x0B),
+	/* D6 */ C_DBG(ARG_U8, 0x26),
+	/* D7 */ C_DBG(ARG_U8, 0x26),
+	/* D8-DB */ C_DBG(ARG_U8, 0x26), C_DBG(ARG_U8, 0x26), C_DBG(ARG_U8, 0x26), C_DBG(ARG_U8, 0x26),
+	/* DC-DF */ C_DBG(ARG_U8, 0x26), C_DBG(ARG_U8, 0x26), C_DBG(ARG_U8, 0x26), C_DBG(ARG_U8, 0x26),
+	/* E0 */ {ARG_U16, MAP_CTRL, 0x10, 0x7F, 1},
+	/* E1 */ {ARG_U16, MAP_TEMPO, 0, 0, 0},
+	/* E2 */ C_UNK,
+	/* E3 */ C_DBG(ARG_U16, 0),
+	/* E4-EF */ C_UNK, C_UNK, C_UNK, C_UNK, C_UNK8,
+	/* F0-FA */ C_UNK8, C_UNK, C_UNK, C_UNK,
+	/* FB */ C_DBG(ARG_NONE, 0),
+	/* FC */ {ARG_NONE, MAP_MARK, 0x6F, 1, 0},
+	/* FD */ C_FLOW(ARG_NONE),
+	/* FE */ C_DBG(ARG_U16, 0),
+	/* FF */ C_FLOW(ARG_NONE),
+	/* EOF */ C_FLOW(ARG_NONE),
+};
+
+#undef C_NOTE
+#undef C_UNK
+#undef C_FLOW
+#undef C_CTRL
+#undef C_DCTRL
+#undef C_DBG
+#undef C_NOTE8
+#undef C_UNK8
+
+static_assert(gCmdDesc[0xE1].gMap == MAP_TEMPO &&
+              gCmdDesc[0xFF].gMap == MAP_FLOW  &&
+              gCmdDesc[INSN_EOF].gMap == MAP_FLOW, "command table misaligned");
+
+/**************************************/
+
+//! pre-decoded command, 16 bytes
+typedef struct {
+	u32 gPos;  //! source position [offset]
+	u32 gArg0; //! argument, note length, split/jump/call target [offset]
+	u32 gDest; //! split/jump/call target [insn]
+	u16 gCmd;  //! command byte / INSN_EOF
+	u8  gArg1; //! note velocity, split track
+	u8  gFlag; //! INSN_LABEL, INSN_LINKED
+} Insn_t;
+
+static_assert(sizeof(Insn_t) == 16, "Insn_t grew");
+
+/**************************************/
+
+static inline u32 Pop64(u64 x) {
+#ifdef __GNUC__
+	return __builtin_popcountll(x);
+#else
+	u32 n = 0;
+	for(;x;x&=x-1) n++;
+	return n;
+#endif
+}
+
+static inline u32 Ctz64(u64 x) {
+#ifdef __GNUC__
+	return __builtin_ctzll(x);
+#else
+	u32 n = 0;
+	for(;!(x&1);x>>=1) n++;
+	return n;
+#endif
+}
+
+/**************************************/
+
+//! decoded DATA chunk, commands in position order
+//! a command falls through to the next one unless INSN_LINKED
+typedef struct {
+	vector<Insn_t>          gInsn; //! decoded commands
+	vector< pair<u32,u32> > gLink; //! other fall-through [insn -> insn], by insn
+	
+	//! clear program
+	void Reset(void) {
+		gInsn.clear();
+		gLink.clear();
+	}
+	
+	//! clear program and give its memory back
+	void Release(void) {
+		vector<Insn_t>().swap(gInsn);
+		vector< pair<u32,u32> >().swap(gLink);
+	}
+	
+	//! fall-through of command i, if it has one
+	u32 Link(u32 i) const {
+		if(!(gInsn[i].gFlag & INSN_LINKED)) return i + 1;
+		return lower_bound(gLink.begin(), gLink.end(), make_pair(i, 0u))->second;
+	}
+	
+	//! fall-through [insn] / INSN_NONE after an end
+	u32 Next(u32 i) const {
+		u32 cmd = gInsn[i].gCmd;
+		if(cmd == 0xFF || cmd == INSN_EOF) return INSN_NONE;
+		return Link(i);
+	}
+	
+	//! target offset of split/jump/call
+	static u32 Target(const Insn_t &op) {
+		switch(gCmdDesc[op.gCmd].gArgs) {
+			case ARG_SPLIT:
+			case ARG_ADR:   return op.gArg0;
+		} return INSN_NONE;
+	}
+	
+	//! decode command at cursor
+	static void DecodeOne(Cursor_t &rseq, u32 mdOff, Insn_t &op) {
+		u32 cmd = rseq.Get();
+		op.gCmd  = cmd;
+		op.gArg0 = 0;
+		op.gArg1 = 0;
+		
+		//! read arguments by layout
+		switch(gCmdDesc[cmd].gArgs) {
+			case ARG_U8:
+				op.gArg0 = rseq.Get();
+				break;
+			case ARG_U16:
+				op.gArg0 = ReadBE(rseq, 16);
+				break;
+			case ARG_VAR:
+				op.gArg0 = ReadVarLen(rseq);
+				break;
+			case ARG_NOTE:
+				op.gArg1 = rseq.Get();
+				op.gArg0 = ReadVarLen(rseq);
+				break;
+			
+			//! bank select bytes are skipped
+			case ARG_PRG: {
+				u32 c = op.gArg0 = rseq.Get();
+				if(c&0x80) c = rseq.Get();
+				if(c&0x80) c = rseq.Get();
+			} break;
+			
+			case ARG_SPLIT:
+				op.gArg1 = ReadBE(rseq,  8);
+				op.gArg0 = ReadBE(rseq, 24) + mdOff;
+				break;
+			case ARG_ADR:
+				op.gArg0 = ReadBE(rseq, 24) + mdOff;
+				break;
+		}
+	}
+	
+	//! decode command at pos, CUR_* if it can't run
+	static u32 DecodeAt(Cursor_t &rseq, u32 mdOff, u32 pos, Insn_t &op) {
+		rseq.Seek(pos);
+		rseq.gErr = CUR_OK;
+		DecodeOne(rseq, mdOff, op);
+		
+		//! cut off by the end, only fatal if it's ever run
+		u32 err = rseq.gErr;
+		rseq.gErr = CUR_OK;
+		if(err) return err;
+		
+		//! split to a track that doesn't exist, as fatal as a bad jump
+		if(op.gCmd == 0x88 && op.gArg1 >= 16) return CUR_TRACK;
+		
+		//! tempo 0 has no quarter note length
+		if(op.gCmd == 0xE1 && !op.gArg0) return CUR_TEMPO;
+		return CUR_OK;
+	}
+	
+	//! decode everything reachable from the addresses in entry, which
+	//! come back as their commands; labels at a command get INSN_LABEL
+	//! starts are found first in a bitmap over DATA (slot size = past
+	//! the end), the commands are then laid out by position and every
+	//! target looked up by counting the starts before it
+	void Decode(Cursor_t &rseq, u32 mdOff, vector<u32> &entry, const rseq_label_t *labels) {
+		u32 size  = rseq.gSize;
+		u32 words = (size + 64) / 64;
+		vector<u64> seen(words, 0);
+		u32 endPos = size;
+		u32 count  = 0;
+		Insn_t op;
+		
+		//! starts: straight-line runs until they meet known code
+		vector<u32> work;
+		for(u32 e=0;e<entry.size();e++) {
+			work.push_back(entry[e]);
+			while(!work.empty()) {
+				u32 pos = work.back(); work.pop_back();
+				while(1) {
+					u32 slot = min(pos, size);
+					u64 bit  = 1ull << (slot & 63);
+					if(seen[slot >> 6] & bit) break;
+					seen[slot >> 6] |= bit;
+					count++;
+					
+					//! ran off the end, first such address names the slot
+					if(pos >= size) {
+						endPos = pos;
+						break;
+					}
+					if(DecodeAt(rseq, mdOff, pos, op)) break;
+					
+					//! queue branch target
+					u32 tgt = Target(op);
+					if(tgt != INSN_NONE) work.push_back(tgt);
+					
+					//! end of track has no fall-through
+					if(op.gCmd == 0xFF) break;
+					pos = rseq.Tell();
+				}
+			}
+		}
+		
+		//! starts before each bitmap word
+		vector<u32> rank(words);
+		for(u32 w=0,n=0;w<words;w++) {
+			rank[w] = n;
+			n += Pop64(seen[w]);
+		}
+		auto Index = [&](u32 pos) -> u32 {
+			u32 slot = min(pos, size);
+			return rank[slot >> 6] + Pop64(seen[slot >> 6] & ((1ull << (slot & 63)) - 1));
+		};
+		
+		//! lay out by position
+		gInsn.clear();
+		gInsn.reserve(count);
+		gLink.clear();
+		u32 lbl = 0;
+		for(u32 w=0;w<words;w++) {
+			for(u64 m=seen[w];m;m&=m-1) {
+				u32 slot = w*64 + Ctz64(m);
+				u32 idx  = gInsn.size();
+				gInsn.push_back(Insn_t());
+				Insn_t &in = gInsn.back();
+				in.gDest = INSN_NONE;
+				in.gFlag = 0;
+				
+				//! label on this command?
+				if(labels) {
+					while(lbl < labels->size() && (u64)(*labels)[lbl].pos + mdOff < slot) lbl++;
+					if(lbl < labels->size() && (u64)(*labels)[lbl].pos + mdOff == slot) in.gFlag |= INSN_LABEL;
+				}
+				
+				if(slot == size) {
+					in.gPos  = endPos;
+					in.gCmd  = INSN_EOF;
+					in.gArg0 = CUR_RANGE;
+					in.gArg1 = 0;
+					continue;
+				}
+				
+				in.gPos = slot;
+				u32 err = DecodeAt(rseq, mdOff, slot, in);
+				if(err) {
+					in.gCmd  = INSN_EOF;
+					in.gArg0 = err;
+					in.gArg1 = 0;
+					continue;
+				}
+				
+				u32 tgt = Target(in);
+				if(tgt != INSN_NONE) in.gDest = Index(tgt);
+				
+				//! fall-through that isn't the next start: a misaligned
+				//! target decoded in between
+				if(in.gCmd != 0xFF) {
+					u32 next = Index(rseq.Tell());
+					if(next != idx + 1) {
+						in.gFlag |= INSN_LINKED;
+						gLink.push_back(make_pair(idx, next));
+					}
+				}
+			}
+		}
+		
+		for(u32 e=0;e<entry.size();e++) entry[e] = Index(entry[e]);
+	}
+} Program_t;
+
+/**************************************/
+
+//! basic block, commands gHead..gTail along Program_t::Next
+typedef struct {
+	u32 gHead;    //! first command [insn]
+	u32 gTail;    //! last command [insn]
+	u32 gEnd;     //! past its last byte [offset]
+	u32 gSucc[2]; //! successors [block] / INSN_NONE
+} Block_t;
+
+//! cycle in the graph, one strongly connected component
+typedef struct {
+	u32 gHead;  //! first block [offset]
+	u32 gCount; //! blocks on it
+	u8  gWait;  //! has a rest, so it advances time
+	u8  gCall;  //! goes through a call
+} Cycle_t;
+
+//! contexts a block runs in
+#define FLOW_TOP (0x01) //! empty call stack, a return falls through
+#define FLOW_SUB (0x02) //! inside a call, a return goes back
+
+//! control-flow graph of a decoded program
+typedef struct {
+	vector<u32>     gLen;   //! command length [bytes], by insn
+	vector<u32>     gBlkOf; //! block, by insn
+	vector<Block_t> gBlock; //! blocks, by position
+	vector<Cycle_t> gCycle; //! cycles, by first block
+	vector<u8>      gLive;  //! block can run [FLOW_TOP | FLOW_SUB], by block
+	
+	//! split the program into blocks at entries, targets and after control flow
+	void Build(const Program_t &prog, Cursor_t &code, u32 mdOff, const vector<u32> &entry, bool ignJump) {
+		const vector<Insn_t> &insn = prog.gInsn;
+		u32 n = insn.size();
+		
+		//! lengths, decoding again is cheaper than keeping them for every render
+		gLen.assign(n, 0);
+		for(u32 i=0;i<n;i++) {
+			const Insn_t &op = insn[i];
+			if(op.gPos >= code.gSize) continue;
+			if(op.gCmd == INSN_EOF && op.gArg0 != CUR_TRACK && op.gArg0 != CUR_TEMPO) {
+				gLen[i] = code.gSize - op.gPos;
+				continue;
+			}
+			
+			Insn_t tmp;
+			code.Seek(op.gPos);
+			Program_t::DecodeOne(code, mdOff, tmp);
+			gLen[i] = code.Tell() - op.gPos;
+		}
+		code.gErr = CUR_OK;
+		
+		//! leaders: entries, targets, anything after control flow
+		//! or reached from more than one straight-line run
+		vector<u8> pred(n, 0);
+		vector<u8> lead(n, 0);
+		for(u32 i=0;i<entry.size();i++)
+			if(entry[i] != INSN_NONE) lead[entry[i]] = 1;
+		for(u32 i=0;i<n;i++) {
+			const Insn_t &op = insn[i];
+			bool flow = gCmdDesc[op.gCmd].gMap == MAP_FLOW;
+			u32 next = prog.Next(i);
+			if(op.gDest != INSN_NONE) lead[op.gDest] = 1;
+			if(next == INSN_NONE) continue;
+			if(flow || pred[next]) lead[next] = 1;
+			pred[next] = 1;
+		}
+		
+		vector<u32> head;
+		for(u32 i=0;i<n;i++) if(lead[i] || !pred[i]) head.push_back(i);
+		sort(head.begin(), head.end(),
+			[&](u32 a, u32 b) { return insn[a].gPos < insn[b].gPos; });
+		
+		//! walk each block to the next leader
+		gBlkOf.assign(n, INSN_NONE);
+		gBlock.resize(head.size());
+		for(u32 b=0;b<head.size();b++) {
+			u32 t = head[b];
+			while(1) {
+				gBlkOf[t] = b;
+				const Insn_t &op = insn[t];
+				if(gCmdDesc[op.gCmd].gMap == MAP_FLOW) break;
+				u32 next = prog.Next(t);
+				if(next == INSN_NONE || lead[next]) break;
+				t = next;
+			}
+			
+			Block_t &blk = gBlock[b];
+			blk.gHead  = head[b];
+			blk.gTail  = t;
+			blk.gEnd   = insn[t].gPos + gLen[t];
+		}
+		
+		//! successors, splits start another track and aren't followed
+		for(u32 b=0;b<gBlock.size();b++) {
+			Block_t &blk = gBlock[b];
+			const Insn_t &op = insn[blk.gTail];
+			u32 next = prog.Next(blk.gTail);
+			u32 dest = (op.gDest != INSN_NONE) ? gBlkOf[op.gDest] : INSN_NONE;
+			if(next != INSN_NONE) next = gBlkOf[next];
+			
+			blk.gSucc[0] = blk.gSucc[1] = INSN_NONE;
+			switch(op.gCmd) {
+				case 0x89:
+					blk.gSucc[0] = dest;
+					if(ignJump) blk.gSucc[1] = next;
+					break;
+				case 0x8A:
+					blk.gSucc[0] = dest;
+					blk.gSucc[1] = next;
+					break;
+				case 0xFD:
+				case 0xFF:
+				case INSN_EOF:
+					break;
+				default:
+					blk.gSucc[0] = next;
+					break;
+			}
+		}
+	}
+	
+	//! blocks the renderer can run under the given options, from entry
+	//! the decoder follows every fall-through, most of which never runs
+	void Reach(const Program_t &prog, const vector<u32> &entry, bool ignJump, u32 loops) {
+		u32 n = gBlock.size();
+		vector< pair<u32, u8> > work;
+		gLive.assign(n, 0);
+		for(u32 i=0;i<entry.size();i++)
+			if(entry[i] != INSN_NONE) work.push_back(make_pair(gBlkOf[entry[i]], (u8)FLOW_TOP));
+		
+		while(!work.empty()) {
+			u32 b  = work.back().first;
+			u8  cx = work.back().second;
+			work.pop_back();
+			if(b == INSN_NONE || (gLive[b] & cx)) continue;
+			gLive[b] |= cx;
+			
+			const Insn_t &op = prog.gInsn[gBlock[b].gTail];
+			u32 next = prog.Next(gBlock[b].gTail);
+			u32 dest = (op.gDest != INSN_NONE) ? gBlkOf[op.gDest] : INSN_NONE;
+			if(next != INSN_NONE) next = gBlkOf[next];
+			switch(op.gCmd) {
+				//! split starts a track, this one carries on
+				case 0x88:
+					work.push_back(make_pair(dest, (u8)FLOW_TOP));
+					work.push_back(make_pair(next, cx));
+					break;
+				
+				//! ignored, taken forward, backward only under -loops
+				//! and a backward jump ends the track once it isn't taken
+				case 0x89:
+					if(ignJump) work.push_back(make_pair(next, cx));
+					else if(op.gArg0 > op.gPos + 4 || loops) work.push_back(make_pair(dest, cx));
+					break;
+				
+				//! call returns after itself
+				case 0x8A:
+					work.push_back(make_pair(dest, (u8)FLOW_SUB));
+					work.push_back(make_pair(next, cx));
+					break;
+				
+				//! return without a call stack is a no-op
+				case 0xFD:
+					if(cx == FLOW_TOP) work.push_back(make_pair(next, cx));
+					break;
+				
+				case 0xFF:
+				case INSN_EOF:
+					break;
+				default:
+					work.push_back(make_pair(next, cx));
+					break;
+			}
+		}
+	}
+	
+	//! find cycles among the live blocks, Tarjan's SCC without recursion
+	void Cycles(const Program_t &prog) {
+		u32 n = gBlock.size();
+		vector<u32> idx(n, INSN_NONE), low(n, 0), stk;
+		vector<u8>  on(n, 0);
+		vector< pair<u32, u32> > work;
+		u32 count = 0;
+		
+		//! rests in each block
+		vector<u8> rest(n, 0);
+		for(u32 b=0;b<n;b++) {
+			for(u32 t=gBlock[b].gHead;;t=prog.Next(t)) {
+				const Insn_t &op = prog.gInsn[t];
+				if(op.gCmd == 0x80 && op.gArg0) rest[b] = 1;
+				if(t == gBlock[b].gTail) break;
+			}
+		}
+		
+		//! may wait: a rest is reachable from the block, so a call to it
+		//! can advance time, spread backward over the successors
+		vector<u32> first(n + 1, 0), pred;
+		for(u32 b=0;b<n;b++) for(u32 k=0;k<2;k++)
+			if(gBlock[b].gSucc[k] != INSN_NONE) first[gBlock[b].gSucc[k] + 1]++;
+		for(u32 b=0;b<n;b++) first[b+1] += first[b];
+		pred.resize(first[n]);
+		vector<u32> fill(first.begin(), first.end() - 1);
+		for(u32 b=0;b<n;b++) for(u32 k=0;k<2;k++)
+			if(gBlock[b].gSucc[k] != INSN_NONE) pred[fill[gBlock[b].gSucc[k]]++] = b;
+		
+		vector<u8>  wait(rest);
+		vector<u32> todo;
+		for(u32 b=0;b<n;b++) if(wait[b]) todo.push_back(b);
+		while(!todo.empty()) {
+			u32 b = todo.back(); todo.pop_back();
+			for(u32 p=first[b];p<first[b+1];p++) {
+				if(wait[pred[p]]) continue;
+				wait[pred[p]] = 1;
+				todo.push_back(pred[p]);
+			}
+		}
+		
+		gCycle.clear();
+		for(u32 r=0;r<n;r++) {
+			if(idx[r] != INSN_NONE || !gLive[r]) continue;
+			
+			idx[r] = low[r] = count++;
+			stk.push_back(r); on[r] = 1;
+			work.push_back(make_pair(r, 0u));
+			while(!work.empty()) {
+				u32 v = work.back().first;
+				
+				//! next successor
+				if(work.back().second < 2) {
+					u32 w = gBlock[v].gSucc[work.back().second++];
+					if(w == INSN_NONE || !gLive[w]) continue;
+					if(idx[w] == INSN_NONE) {
+						idx[w] = low[w] = count++;
+						stk.push_back(w); on[w] = 1;
+						work.push_back(make_pair(w, 0u));
+					}
+					else if(on[w]) low[v] = min(low[v], idx[w]);
+					continue;
+				}
+				
+				//! done with v
+				work.pop_back();
+				if(!work.empty()) {
+					u32 u = work.back().first;
+					low[u] = min(low[u], low[v]);
+				}
+				if(low[v] != idx[v]) continue;
+				
+				//! v roots a component, a cycle if it has an edge inside
+				Cycle_t cy;
+				cy.gHead  = INSN_NONE;
+				cy.gCount = 0;
+				cy.gWait  = 0;
+				cy.gCall  = 0;
+				u32 top = stk.size();
+				while(stk[--top] != v);
+				
+				bool loop = (stk.size() - top) > 1;
+				for(u32 k=top;k<stk.size();k++) {
+					const Block_t &blk = gBlock[stk[k]];
+					if(blk.gSucc[0] == stk[k] || blk.gSucc[1] == stk[k]) loop = true;
+				}
+				
+				if(loop) {
+					for(u32 k=top;k<stk.size();k++) {
+						u32 b = stk[k];
+						const Block_t &blk = gBlock[b];
+						cy.gCount++;
+						cy.gHead = min(cy.gHead, prog.gInsn[blk.gHead].gPos);
+						
+						//! rests on it?
+						if(rest[b]) cy.gWait = 1;
+						
+						//! call into the cycle itself, or out to something that may wait
+						const Insn_t &op = prog.gInsn[blk.gTail];
+						u32 d = blk.gSucc[0];
+						if(op.gCmd != 0x8A || d == INSN_NONE) continue;
+						if(on[d] && idx[d] >= idx[v]) cy.gCall = 1;
+						else if(wait[d]) cy.gWait = 1;
+					}
+					gCycle.push_back(cy);
+				}
+				
+				for(u32 k=top;k<stk.size();k++) on[stk[k]] = 0;
+				stk.resize(top);
+			}
+		}
+		
+		sort(gCycle.begin(), gCycle.end(),
+			[](const Cycle_t &a, const Cycle_t &b) { return a.gHead < b.gHead; });
+	}
+} Flow_t;
+
+/**************************************/
+
+struct Converter_t;
+typedef void (*TrackRun_t)(Converter_t *cv, Track_t *trk, u32 i);
+
+//! parallel track scheduler
+typedef struct {
+	mutex          gLock;
+	vector<thread> gWork;     //! spawned workers
+	TrackRun_t     gRun;      //! dispatch backend
+	bool           gOn;       //! tracks run in parallel
+	u8             gBusy[16]; //! worker owns track
+	u8             gRan[16];  //! track has run
+	u8             gWake[16]; //! split seen while busy
+	u32            gWAdr[16]; //! ... its address
+	u32            gWIP[16];  //! ... its insn
+} Sched_t;
+
+//! conversion context, owns everything a conversion touches
+struct Converter_t {
+	//! options + log sink
+	Options_t gOpt;
+	Log_t     gLog;
+	
+	//! state
+	u32 gStat;
+	
+	//! RSEQ chunk header
+	RSEQHead_t gRSEQHead;
+	
+	//! DATA chunk header
+	DATAHead_t gDATAHead;
+	
+	//! DATA chunk header
+	LABLHead_t gLABLHead;
+	
+	//! RSEQ tracks
+	Track_t gTrack[16];
+	
+	//! Label Data
+	rseq_label_t gLabels;
+	
+	//! decoded DATA chunk, and the one being rendered (gProg or shared)
+	Program_t        gProg;
+	const Program_t *gCode;
+	
+	//! parallel tracks
+	Sched_t gSched;
+	
+	//! first error [CUR_*] + where, aborts the file
+	u8  gErr;
+	u32 gEPos;
+	
+	//! output bytes rendered, all tracks
+	atomic<u32> gBytes;
+	
+	//! console output, held back until the file is done
+	FILE  *gCon;
+	bool   gBuf;
+	string gOut;
+	
+	//! reset all
 	void Reset(void) {
 		//! clear state
 		gStat = 0;
@@ -507,498 +2165,863 @@ static struct {
 		memset(&gDATAHead, 0, sizeof(gDATAHead));
 		memset(&gLABLHead, 0, sizeof(gLABLHead));
 		gLabels.clear();
+		gProg.Reset();
+		gCode = &gProg;
+		
+		Rewind();
+	}
+	
+	//! clear what a render leaves behind, the parse stays
+	void Rewind(void) {
+		gErr   = CUR_OK;
+		gEPos  = 0;
+		gBytes = 0;
 		
 		//! reset tracks
 		for(int i=0;i<16;i++) gTrack[i].Reset(i);
 	}
-} gData;
+	
+	//! tracks point back at the options + log of this converter
+	Converter_t(const Options_t &opt, FILE *log) {
+		gOpt        = opt;
+		gLog.gFile  = log;
+		gLog.gLevel = log ? gOpt.gLogLvl : LOG_OFF;
+		gCon        = stdout;
+		gBuf        = false;
+		gSched.gOn  = false;
+		for(int i=0;i<16;i++) {
+			gTrack[i].gOpt = &gOpt;
+			gTrack[i].gLog = &gLog;
+		}
+		Reset();
+	}
+	
+	~Converter_t() {
+		gLog.Flush();
+	}
+	
+	//! console message, held back in gOut when buffering
+	//! -scan leaves the console to its records
+	void Print(const char *str, ...) {
+		if(gOpt.gScan) return;
+		
+		va_list myList;
+		va_start(myList, str);
+		if(gBuf) {
+			char buf[0x200];
+			vsnprintf(buf, sizeof(buf), str, myList);
+			gOut += buf;
+		} else vfprintf(gCon, str, myList);
+		va_end(myList);
+	}
+	
+	//! -scan record, any length
+	void Record(const string &line) {
+		if(gBuf) gOut += line;
+		else fputs(line.c_str(), gCon);
+	}
+	
+	//! record the first error, every track stops at its next chance
+	void Fail(u8 err, u32 pos) {
+		lock_guard<mutex> lock(gSched.gLock);
+		if(gErr) return;
+		gErr  = err;
+		gEPos = pos;
+	}
+	
+	//! read chunk headers + labels, false if the file can't be converted
+	bool Proc(Cursor_t &rseq);
+	
+	//! decode, render every track and build the SMF in smf
+	//! false if a track ran into bad data
+	bool Do(Cursor_t &rseq, vector<u8> &smf);
+	
+	//! decode DATA into gProg from the sequence start, and from every
+	//! label into entry when given; code is left on the DATA chunk
+	u32 Decode(Cursor_t &rseq, Cursor_t &code, vector<u32> *entry);
+	
+	//! render track 0 from entry and all it spawns, as Do
+	bool Render(u32 adr, u32 entry, vector<u8> &smf);
+	
+	//! decode from the start and every label, dump the control flow to out
+	bool Analyze(Cursor_t &rseq, vector<u8> &out);
+};
 
 /**************************************/
 
-void rseqDo(FILE *midi, FILE *rseq) {
-	u32 mdOff = gData.gDATAHead.fOff;
+//! assemble complete SMF image (MThd + every MTrk) in one buffer
+//! -events tracks are encoded from their columns straight into it
+static void SmfBuild(Converter_t *cv, vector<u8> &smf) {
+	//! count tracks + total size
+	u32 trkMax = 0;
+	u32 total  = 14;
+	for(int i=0;i<16;i++) {
+		const Track_t &trk = cv->gTrack[i];
+		u32 len = trk.gEvnt.Count() ? trk.gSize : trk.gData.size();
+		if(!len) continue;
+		
+		trkMax++;
+		total += 8 + len;
+	}
 	
-	//! debug
-	DebugMsg("  Begin decoding...\n");
+	smf.clear();
+	smf.reserve(total);
 	
-	//! start track 0
-	gData.gTrack[0].Start(mdOff);
+	//! MThd header
+	//! 96-tick per quarter-note resolution
+	PushBE(smf, 0x4D546864, 32);
+	PushBE(smf, 6,          32);
+	PushBE(smf, 1,          16);
+	PushBE(smf, trkMax,     16);
+	PushBE(smf, 96,         16);
 	
-	//! process while there's tracks
-	//! this setup is needed 'just in case'
-	//! as tracks can spawn from *any* track
-	bool gTrkCnt = true;
-	while(gTrkCnt) {
-		//! flip process flag
-		gTrkCnt = false;
+	//! process each track
+	for(int i=0;i<16;i++) {
+		const Track_t &trk = cv->gTrack[i];
 		
-		//! process each track
-		for(u32 i=0;i<16;i++) {
-			//! verify track is active
-			Track_t *trk = &gData.gTrack[i];
-			if(!trk->gStat) continue;
+		//! events: MTrk header, data, length patched in after
+		if(trk.gEvnt.Count()) {
+			PushBE(smf, 0x4D54726B, 32);
+			PushBE(smf, 0,          32);
+			u32 head = smf.size();
+			trk.gEvnt.Serialize(smf, cv->gOpt.gRunStat);
 			
-			//! continue the main loop as we have a track
-			gTrkCnt = true;
+			u32 len = smf.size() - head;
+			for(u32 k=0;k<4;k++) smf[head - 4 + k] = len >> (24 - 8*k);
+			continue;
+		}
+		
+		//! have data?
+		const vector<u8> &data = trk.gData;
+		if(data.empty()) continue;
+		
+		//! yop, MTrk header + data
+		PushBE(smf, 0x4D54726B,  32);
+		PushBE(smf, data.size(), 32);
+		smf.insert(smf.end(), data.begin(), data.end());
+	}
+}
+
+/**************************************/
+
+//! merge cursor: next event of one track
+typedef struct {
+	u32 gTick; //! its position
+	u32 gTrk;  //! track
+	u32 gNext; //! its index
+	u32 gMeta; //! next meta [gPay index]
+} Merge_t;
+
+//! min-heap order for merge cursors: position, then track
+struct MergeLater {
+	bool operator()(const Merge_t &a, const Merge_t &b) const {
+		if(a.gTick != b.gTick) return a.gTick > b.gTick;
+		return a.gTrk > b.gTrk;
+	}
+};
+
+//! assemble a format 0 SMF: every track's events merged into one MTrk
+//! by a heap over the track heads, O(N log T) in a single pass; equal
+//! positions keep track order, each track's own ends go, one closes it
+static void SmfMerge(Converter_t *cv, vector<u8> &smf) {
+	const bool runStat = cv->gOpt.gRunStat;
+	vector<Merge_t> heap;
+	u32 total = 0;
+	u32 end   = 0;
+	for(u32 i=0;i<16;i++) {
+		const EventList_t &ev = cv->gTrack[i].gEvnt;
+		if(!ev.Count()) continue;
+		
+		Merge_t m = {ev.gTick[0], i, 0, 0};
+		heap.push_back(m);
+		total += cv->gTrack[i].gSize;
+		end    = max(end, ev.TickAt(ev.Count()));
+	}
+	make_heap(heap.begin(), heap.end(), MergeLater());
+	
+	smf.clear();
+	smf.reserve(14 + 8 + total + 4);
+	
+	//! MThd header, one track
+	//! 96-tick per quarter-note resolution
+	PushBE(smf, 0x4D546864, 32);
+	PushBE(smf, 6,          32);
+	PushBE(smf, 0,          16);
+	PushBE(smf, 1,          16);
+	PushBE(smf, 96,         16);
+	
+	//! MTrk header, length patched in once known
+	PushBE(smf, 0x4D54726B, 32);
+	PushBE(smf, 0,          32);
+	u32 head = smf.size();
+	
+	u32 pos  = 0;
+	u8  last = 0;
+	while(!heap.empty()) {
+		//! earliest head, write it unless it ends its track
+		pop_heap(heap.begin(), heap.end(), MergeLater());
+		Merge_t &m = heap.back();
+		const EventList_t &ev = cv->gTrack[m.gTrk].gEvnt;
+		if(!ev.IsEnd(m.gNext)) {
+			PushVar(smf, m.gTick - pos);
+			pos = m.gTick;
+			ev.Put(smf, m.gNext, m.gMeta, runStat, last);
+		} else m.gMeta++;
+		
+		//! advance that track, or drop it
+		if(++m.gNext < ev.Count()) {
+			m.gTick = ev.gTick[m.gNext];
+			push_heap(heap.begin(), heap.end(), MergeLater());
+		} else heap.pop_back();
+	}
+	
+	//! end of track at the last track's end
+	PushVar(smf, end - pos);
+	PushBE(smf, 0xFF2F00, 24);
+	
+	u32 len = smf.size() - head;
+	for(u32 i=0;i<4;i++) smf[head - 4 + i] = len >> (24 - 8*i);
+}
+
+/**************************************/
+
+//! write label text of a command that has one
+//! the runners check INSN_LABEL themselves, this stays out of the hot path
+template<class S> static void TrackLabel(Converter_t *cv, Track_t *trk, const Insn_t *op) {
+	u32 pos = op->gPos - cv->gDATAHead.fOff;
+	rseq_label_t::const_iterator it = lower_bound(cv->gLabels.begin(), cv->gLabels.end(), pos,
+		[](const rseq_label_entry_t &a, u32 b) { return a.pos < b; });
+	if(it == cv->gLabels.end() || it->pos != pos) return;
+	
+	//! Write Event FF 06 len, text
+	trk->mMetaEvent<S>(0x06, it->len, it->text);
+}
+
+/**************************************/
+
+//! worker: run track, then any split that arrived meanwhile
+static void TrackWorker(Converter_t *cv, u32 t) {
+	Track_t *trk = &cv->gTrack[t];
+	while(1) {
+		cv->gSched.gRun(cv, trk, t);
+		
+		lock_guard<mutex> lock(cv->gSched.gLock);
+		cv->gSched.gRan[t] = 1;
+		if(!cv->gSched.gWake[t] || cv->gErr) {
+			cv->gSched.gBusy[t] = 0;
+			return;
+		}
+		cv->gSched.gWake[t] = 0;
+		trk->Start(cv->gSched.gWAdr[t], cv->gSched.gWIP[t]);
+	}
+}
+
+//! split: start track, on its own worker when running in parallel
+static void TrackSplit(Converter_t *cv, u32 self, u32 t, u32 adr, u32 ip) {
+	if(!cv->gSched.gOn || t == self) {
+		cv->gTrack[t].Start(adr, ip);
+		return;
+	}
+	
+	lock_guard<mutex> lock(cv->gSched.gLock);
+	if(cv->gErr) return;
+	if(cv->gSched.gBusy[t]) {
+		//! restart once the current run is over
+		cv->gSched.gWake[t] = 1;
+		cv->gSched.gWAdr[t] = adr;
+		cv->gSched.gWIP[t]  = ip;
+		return;
+	}
+	
+	cv->gSched.gBusy[t] = 1;
+	cv->gTrack[t].Start(adr, ip);
+	cv->gSched.gWork.push_back(thread(TrackWorker, cv, t));
+}
+
+/**************************************/
+
+//! file budget left, counting this track's output not yet accounted for
+template<class S> static inline u32 TrackFileRoom(Converter_t *cv, Track_t *trk) {
+	u32 used = cv->gBytes + (S::Size(*trk) - trk->gAcct);
+	return used < cv->gOpt.gMaxFilB ? cv->gOpt.gMaxFilB - used : 0;
+}
+
+//! split/jump/call/return/end, false once the track is over
+template<class S> static bool TrackFlow(Converter_t *cv, Track_t *trk, u32 i, const Insn_t &op, u32 &ip, u32 &left) {
+	switch(op.gCmd) {
+		//! split
+		case 0x88: {
+			//! start new track
+			trk->NoMemo();
+			trk->gSplt++;
+			TrackSplit(cv, i, op.gArg1, op.gArg0, op.gDest);
+		} break;
+		
+		//! jump
+		case 0x89: {
+			//! fetch address
+			u32 adr = op.gArg0;
 			
-			//! seek to current track position
-			fseek(rseq, trk->gDPos, SEEK_SET);
+			char msgbuf[0x20];
+			const char* jumpDirMsg;
+			const char* jumpMsg;
+			bool jumpDir;
+			bool takeJump = false;
 			
-			//! loop until end of track
-			bool loop = true;
-			u32 lcount = 0;
-			while(loop) {
-				u32 curpos = ftell(rseq) - mdOff;
-				rseq_label_t::iterator it = gData.gLabels.find(curpos);
-				if (it != gData.gLabels.end())
+			jumpDir = (adr > op.gPos + 4);
+			jumpDirMsg = jumpDir ? "forwards" : "backwards";
+			if (jumpDir)
+				takeJump = true;
+			else
+			{
+				//! -loops N takes it N times, then ends the track
+				trk->gHasL = 1;
+				if (! cv->gOpt.gIgnJump)
+					takeJump = trk->LoopTake(op.gPos, adr);
+			}
+			
+			if (cv->gOpt.gIgnJump)
+				jumpMsg = "ignored";
+			else if (takeJump)
+				jumpMsg = "taken";
+			else
+				jumpMsg = "Track End";
+			
+			//! debug stuff
+			LOG(cv->gLog, LOG_TRACE, "  Trk %02u: Jump (%s) to 0x%X\n", i, jumpDirMsg, adr);
+			
+			snprintf(msgbuf, 0x20, "Jump (%s, %s)", jumpDirMsg, jumpMsg);
+			trk->mMetaEvent<S>(0x06, strlen(msgbuf), (u8*)msgbuf);
+			
+			if (! cv->gOpt.gIgnJump)
+			{
+				if (takeJump)
 				{
-					std::string& data = it->second;
-					// Write Event FF 06 data.length(), data.c_str();
-					trk->mMetaEvent(0x06, data.length(), (u8*)data.c_str());
-				}
-				
-				//! note on [implicit command]
-				u32 cmd = fgetc(rseq);
-				u32 cdata;
-				if(cmd < 0x80) {
-					//! read data
-					u32 key = cmd;
-					u32 vel = fgetc(rseq);
-					u32 len = ReadVarLen(rseq);
-					
-					//! push note-on
-					trk->mNoteOn(key, vel, len);
-					
-					//! continue loop
-					continue;
+					//! take jump, repeated loop passes are copied out
+					ip = op.gDest;
+					if (! jumpDir)
+						trk->LoopSeam<S>(op.gPos, left, TrackFileRoom<S>(cv, trk));
 				}
-				
-				//! switch command
-				switch(cmd) {
-					//! rest
-					case 0x80: {
-						//! read time
-						u32 len = ReadVarLen(rseq);
-						trk->Wait(len);
-					} break;
-					
-					//! program:bank
-					case 0x81: {
-						//! fetch tone
-						u32 c = fgetc(rseq);
-						trk->mPrg(c&127);
-						
-						//! read/skip bank select command if needed
-						if(c&0x80) c = fgetc(rseq);
-						if(c&0x80) c = fgetc(rseq);
-					} break;
-					
-					//! split
-					case 0x88: {
-						//! fetch info
-						u32 trk = ReadBE(rseq,  8);
-						u32 adr = ReadBE(rseq, 24) + mdOff;
-						
-						//! start new track
-						gData.gTrack[trk].Start(adr);
-					} break;
-					
-					//! jump
-					case 0x89: {
-						//! fetch address
-						u32 adr = ReadBE(rseq, 24) + mdOff;
-						
-						char msgbuf[0x20];
-						const char* jumpDirMsg;
-						const char* jumpMsg;
-						bool jumpDir;
-						bool takeJump = false;
-						
-						jumpDir = (adr > ftell(rseq));
-						jumpDirMsg = jumpDir ? "forwards" : "backwards";
-						if (jumpDir)
-							takeJump = true;
-						else
-						{
-							//lcount ++;
-							//if (lcount < 2)
-							//	takeJump = true;
-						}
-						
-						if (ignoreJumps)
-							jumpMsg = "ignored";
-						else if (takeJump)
-							jumpMsg = "taken";
-						else
-							jumpMsg = "Track End";
-						
-						//! debug stuff
-						DebugMsg("  Trk %02u: Jump (%s) to 0x%X\n", i, jumpDirMsg, adr);
-						
-						snprintf(msgbuf, 0x20, "Jump (%s, %s)", jumpDirMsg, jumpMsg);
-						trk->mMetaEvent(0x06, strlen(msgbuf), (u8*)msgbuf);
-						
-						if (! ignoreJumps)
-						{
-							if (takeJump)
-							{
-								//! take forward jump: jump to + set new address
-								fseek(rseq, trk->gDPos = adr, SEEK_SET);
-							}
-							else
-							{
-								//! kill track, stop read loop
-								trk->mEnd();
-								loop = false;
-							}
-						}
-					} break;
-					
-					//! call
-					case 0x8A: {
-						//! fetch targe address
-						u32 adr = mdOff + ReadBE(rseq, 24);
-						
-						//! set return address
-						trk->gRPos = ftell(rseq);
-						
-						//! debug stuff
-						DebugMsg("  Trk %02u: Call to 0x%X\n", i, adr);
-						
-						//! jump to + set new address
-						fseek(rseq, trk->gDPos = adr, SEEK_SET);
-					} break;
-					
-					//! unknown - 1 byte?
-					case 0xB0: {
-						//! skip argument
-						//fseek(rseq, 1, SEEK_CUR);
-						cdata = fgetc(rseq);
-						if (debugCtrls)
-						{
-							trk->mGenCtrl(0x70, cmd & 0x7F);
-							trk->mGenCtrl(0x26, cdata);
-						}
-					} break;
-					
-					//! pan
-					case 0xC0: {
-						//! set pan
-						trk->mPan(fgetc(rseq));
-					} break;
-					
-					//! volume
-					case 0xC1: {
-						//! set volume
-						trk->mVol(fgetc(rseq));
-					} break;
-					
-					//! master vol
-					case 0xC2: {
-						//! just read argument
-						//! unsure on how to handle this, tbh
-						//! maybe vol*mvol/127 on every call?
-						cdata = fgetc(rseq);
-						trk->mGenCtrl(0x27, cdata);
-					} break;
-					
-					//! transpose
-					case 0xC3: {
-						//! step amount
-						//trk->mTranspose(fgetc(rseq));
-						cdata = fgetc(rseq);
-						trk->mNRPN(0x00, 0x02, cdata);
-					} break;
-					
-					//! bend
-					case 0xC4: {
-						//! bend
-						trk->mBnd(fgetc(rseq));
-					} break;
-					
-					//! bend range
-					case 0xC5: {
-						//! bend range
-						trk->mBndRng(fgetc(rseq));
-					} break;
-					
-					//! priority
-					case 0xC6: {
-						//! just read argument
-						//! AFAIK, has no meaning in midi
-						cdata = fgetc(rseq);
-						if (debugCtrls)
-						{
-							trk->mGenCtrl(0x70, cmd & 0x7F);
-							trk->mGenCtrl(0x26, cdata);
-						}
-					} break;
-					
-					//! polyphony
-					case 0xC7: {
-						//! not bothering with this
-						cdata = fgetc(rseq);
-						if (debugCtrls)
-						{
-							trk->mGenCtrl(0x70, cmd & 0x7F);
-							trk->mGenCtrl(0x26, cdata);
-						}
-					} break;
-					
-					//! tie ???
-					case 0xC8: {
-						cdata = fgetc(rseq);
-						if (debugCtrls)
-						{
-							trk->mGenCtrl(0x70, cmd & 0x7F);
-							trk->mGenCtrl(0x26, cdata);
-						}
-					} break;
-					
-					//! portamento cnt
-					case 0xC9: {
-						//! not bothering with this
-						cdata = fgetc(rseq);
-						trk->mGenCtrl(84, cdata);
-					} break;
-					
-					//! mod-depth
-					case 0xCA: {
-						//! not bothering with this
-						cdata = fgetc(rseq);
-						trk->mGenCtrl(1, cdata);
-					} break;
-					
-					//! mod-speed
-					case 0xCB: {
-						//! not bothering with this
-						cdata = fgetc(rseq);
-						if (debugCtrls)
-							trk->mGenCtrl(0x11, cdata);
-					} break;
-					
-					//! mod-type
-					case 0xCC: {
-						//! not bothering with this
-						cdata = fgetc(rseq);
-						if (debugCtrls)
-							trk->mGenCtrl(0x21, cdata);
-					} break;
-					
-					//! mod-range
-					case 0xCD: {
-						//! not bothering with this
-						cdata = fgetc(rseq);
-						if (debugCtrls)
-							trk->mGenCtrl(0x12, cdata);
-					} break;
-					
-					//! portamento
-					case 0xCE: {
-						//! not bothering with this
-						cdata = fgetc(rseq);
-						trk->mGenCtrl(65, cdata);
-					} break;
-					
-					//! portamento-time
-					case 0xCF: {
-						//! not bothering with this
-						cdata = fgetc(rseq);
-						trk->mGenCtrl(5, cdata);
-					} break;
-					
-					case 0xD0: /* attack  */
-						//! not bothering with this
-						cdata = fgetc(rseq);
-						if (debugCtrls)
-							trk->mGenCtrl(73, cdata);
-						break;
-					case 0xD1: /* decay   */
-						//! not bothering with this
-						cdata = fgetc(rseq);
-						if (debugCtrls)
-							trk->mNRPN(0x01, 0x64, cdata);
-						break;
-					case 0xD2: /* sustain */
-						//! not bothering with this
-						cdata = fgetc(rseq);
-						if (debugCtrls)
-							trk->mGenCtrl(91, cdata);
-						break;
-					case 0xD3: /* release */
-						//! not bothering with this
-						cdata = fgetc(rseq);
-						if (debugCtrls)
-							trk->mGenCtrl(72, cdata);
-						break;
-					
-					//! loop start
-					case 0xD4: {
-						//! just a marker command AFAIK
-						//! no arguments
-						trk->mGenCtrl(0x6F, 0);
-					} break;
-					
-					//! expression
-					case 0xD5: {
-						//! set expression
-						trk->mExp(fgetc(rseq));
-					} break;
-					
-					//! print?
-					case 0xD6: {
-						//! yeah, no idea =P
-						cdata = fgetc(rseq);
-						if (debugCtrls)
-						{
-							trk->mGenCtrl(0x70, cmd & 0x7F);
-							trk->mGenCtrl(0x26, cdata);
-						}
-					} break;
-					
-					//! unknown commands - 1 argument
-					case 0xD8:
-					case 0xD9:
-					case 0xDA:
-					case 0xDB: {
-						//! skip arg
-						cdata = fgetc(rseq);
-						if (debugCtrls)
-						{
-							trk->mGenCtrl(0x70, cmd & 0x7F);
-							trk->mGenCtrl(0x26, cdata);
-						}
-					} break;
-					
-					//! mod-delay
-					case 0xE0: {
-						//! not bothering with this
-						u16 cdata = ReadBE(rseq, 16);
-						if (debugCtrls)
-							trk->mGenCtrl(0x10, cdata & 0x7F);
-					} break;
-					
-					//! tempo
-					case 0xE1: {
-						//! set tempo
-						trk->mTmp(ReadBE(rseq, 16));
-					} break;
-					
-					//! sweep?
-					case 0xE3: {
-						//! not bothering with this
-						ReadBE(rseq, 16);
-						if (debugCtrls)
-							trk->mGenCtrl(0x70, cmd & 0x7F);
-					} break;
-					
-					//! loop-end
-					case 0xFC: {
-						//! mark AFAIK
-						//! no args
-						trk->mGenCtrl(0x6F, 1);
-					} break;
-					
-					//! return
-					case 0xFD: {
-						//! has return adr?
-						if(trk->gRPos) {
-							//! seek back
-							fseek(rseq, trk->gDPos = trk->gRPos, SEEK_SET);
-							
-							//! clear old return adr
-							trk->gRPos = 0;
-						}
-					} break;
-					
-					//! track usage
-					case 0xFE: {
-						//! has no meaning in midi AFAIK
-						//! one bit per track used
-						ReadBE(rseq, 16);
-						if (debugCtrls)
-							trk->mGenCtrl(0x70, cmd & 0x7F);
-					} break;
-					
-					//! end of track
-					case 0xFF: {
-						DebugMsg("  Trk %02u End at 0x%X.\n", i, curpos);
-						//! kil trck, stop read loop
-						trk->mEnd();
-						loop = false;
-					} break;
-					
-					//! O_O
-					default: {
-						DebugMsg("  WARNING: Unknown command %02X\n", cmd);
-					} break;
+				else
+				{
+					//! kill track, stop read loop
+					trk->mEnd<S>();
+					return false;
 				}
 			}
+		} break;
+		
+		//! call
+		case 0x8A: {
+			//! debug stuff
+			LOG(cv->gLog, LOG_TRACE, "  Trk %02u: Call to 0x%X\n", i, op.gArg0);
+			
+			//! same call seen before, output spliced in, carry on after it
+			if(trk->Replay<S>(op.gDest, left, TrackFileRoom<S>(cv, trk))) break;
+			
+			//! push return address, jump to target
+			trk->Call<S>(op.gDest, ip, left);
+			ip = op.gDest;
+		} break;
+		
+		//! return
+		case 0xFD: {
+			//! has return adr?
+			if(trk->gCSP) ip = trk->Return<S>(left);
+		} break;
+		
+		//! end of track
+		case 0xFF: {
+			LOG(cv->gLog, LOG_TRACE, "  Trk %02u End at 0x%X.\n", i, op.gPos - cv->gDATAHead.fOff);
+			//! kil trck, stop read loop
+			trk->mEnd<S>();
+			return false;
+		} break;
+		
+		//! ran off DATA or into a cut-off command, abort the file
+		case INSN_EOF: {
+			LOG(cv->gLog, LOG_TRACE, "  ERROR: Trk %02u hit bad data at 0x%X\n", i, op.gPos);
+			cv->Fail(op.gArg0, op.gPos);
+			trk->mEnd<S>();
+			return false;
+		} break;
+	} return true;
+}
+
+/**************************************/
+
+static const char *const gBudName[] = {
+	"", "command", "tick", "track output", "file output",
+};
+
+//! end the track on a spent budget, always true
+template<class S> static bool TrackStop(Converter_t *cv, Track_t *trk, u8 why) {
+	LOG(cv->gLog, LOG_TRACE, "  Trk %02u: %s budget spent\n", trk->gIndx, gBudName[why]);
+	trk->mEnd<S>();
+	trk->gOver = why;
+	return true;
+}
+
+//! tick + output budgets, checked after rests and control flow
+template<class S> static inline bool TrackOver(Converter_t *cv, Track_t *trk) {
+	const Options_t &opt = cv->gOpt;
+	if(trk->gGPos > opt.gMaxTick) return TrackStop<S>(cv, trk, BUD_TICK);
+	
+	u32 size = S::Size(*trk);
+	if(size > opt.gMaxTrkB) return TrackStop<S>(cv, trk, BUD_TRACK);
+	if(size > trk->gAcct) {
+		u32 total = cv->gBytes += size - trk->gAcct;
+		trk->gAcct = size;
+		if(total > opt.gMaxFilB) return TrackStop<S>(cv, trk, BUD_FILE);
+	}
+	return false;
+}
+
+/**************************************/
+
+//! command handlers shared by both dispatch backends, in MAP_* order
+//! S is the event sink of the runner they're expanded in
+#define TRACK_HANDLERS(X)                                          \
+	X(MAP_NOTE,   trk->mNoteOn<S>(cmd, op->gArg1, op->gArg0))     \
+	X(MAP_WAIT,   trk->Wait<S>(op->gArg0);                        \
+	              if(TrackOver<S>(cv, trk)) return)               \
+	X(MAP_PRG,    trk->mPrg<S>(op->gArg0&127))                    \
+	X(MAP_CTRL,   trk->mGenCtrl<S>(cd->gP0, op->gArg0 & cd->gP1)) \
+	X(MAP_MARK,   trk->mGenCtrl<S>(cd->gP0, cd->gP1);             \
+	              trk->gHasL = 1)                                 \
+	X(MAP_NRPN,   trk->mNRPN<S>(cd->gP0, cd->gP1, op->gArg0))     \
+	X(MAP_BEND,   trk->mBnd<S>(op->gArg0))                        \
+	X(MAP_BNDRNG, trk->mBndRng<S>(op->gArg0))                     \
+	X(MAP_TEMPO,  trk->mTmp<S>(op->gArg0))                        \
+	X(MAP_DEBUG,  trk->mGenCtrl<S>(0x70, cmd & 0x7F);             \
+	              if(cd->gP0) trk->mGenCtrl<S>(cd->gP0, op->gArg0))
+
+//! run track to its end, switch dispatch
+template<class S> static void TrackRunSwitch(Converter_t *cv, Track_t *trk, u32 i) {
+	const Program_t &prog = *cv->gCode;
+	u32 ip = trk->gIP;
+	u32 left = cv->gOpt.gMaxInsn;
+	
+	while(1) {
+		if(!left--) {
+			TrackStop<S>(cv, trk, BUD_INSN);
+			return;
+		}
+		
+		const Insn_t *op = &prog.gInsn[ip];
+		if(op->gFlag & INSN_LABEL) TrackLabel<S>(cv, trk, op);
+		
+		//! fall through unless redirected
+		ip = prog.Link(ip);
+		
+		//! table-driven dispatch
+		u32 cmd = op->gCmd;
+		const CmdDesc_t *cd = &gCmdDesc[cmd];
+		if(cd->gDbg && !cv->gOpt.gDbgCtrl) continue;
+		
+		switch(cd->gMap) {
+#define X(m, body) case m: body; break;
+			TRACK_HANDLERS(X)
+#undef X
+			
+			//! control flow
+			case MAP_FLOW:
+				if(!TrackFlow<S>(cv, trk, i, *op, ip, left)) return;
+				if(TrackOver<S>(cv, trk)) return;
+				break;
+			
+			//! O_O
+			default:
+				LOG(cv->gLog, LOG_TRACE, "  WARNING: Unknown command %02X\n", cmd);
+				trk->gUnk[cmd >> 5] |= 1u << (cmd & 31);
+				break;
+		}
+	}
+}
+
+#ifdef __GNUC__
+#define HAVE_THREADED_DISPATCH
+
+//! run track to its end, computed-goto dispatch
+template<class S> static void TrackRunThreaded(Converter_t *cv, Track_t *trk, u32 i) {
+	static void *const disp[] = {
+		&&L_MAP_UNKNOWN,
+		&&L_MAP_FLOW,
+#define X(m, body) &&L_##m,
+		TRACK_HANDLERS(X)
+#undef X
+	};
+	static_assert(sizeof(disp)/sizeof(disp[0]) == MAP_COUNT, "handler table out of sync");
+	
+	const Program_t &prog = *cv->gCode;
+	const Insn_t *op;
+	const CmdDesc_t *cd;
+	u32 ip = trk->gIP;
+	u32 cmd;
+	u32 left = cv->gOpt.gMaxInsn;
+	
+	//! fetch, write label, jump straight to the handler
+#define DISPATCH()                                      \
+	do {                                                \
+		if(!left--) goto L_OVER;                        \
+		op  = &prog.gInsn[ip];                          \
+		if(op->gFlag & INSN_LABEL)                      \
+			TrackLabel<S>(cv, trk, op);                 \
+		ip  = prog.Link(ip);                            \
+		cmd = op->gCmd;                                 \
+		cd  = &gCmdDesc[cmd];                           \
+		if(cd->gDbg && !cv->gOpt.gDbgCtrl) goto L_NEXT; \
+		goto *disp[cd->gMap];                           \
+	} while(0)
+	
+	L_NEXT:
+		DISPATCH();
+		
+#define X(m, body) L_##m: body; DISPATCH();
+	TRACK_HANDLERS(X)
+#undef X
+	
+	L_MAP_FLOW:
+		if(!TrackFlow<S>(cv, trk, i, *op, ip, left)) return;
+		if(TrackOver<S>(cv, trk)) return;
+		DISPATCH();
+	
+	L_MAP_UNKNOWN:
+		LOG(cv->gLog, LOG_TRACE, "  WARNING: Unknown command %02X\n", cmd);
+		trk->gUnk[cmd >> 5] |= 1u << (cmd & 31);
+		DISPATCH();
+	
+	L_OVER:
+		TrackStop<S>(cv, trk, BUD_INSN);
+		return;
+		
+#undef DISPATCH
+}
+#endif
+
+//! build-time backend for sink S, -DNO_THREADED_DISPATCH forces the switch
+template<class S> static inline TrackRun_t TrackRun(void) {
+#if defined(HAVE_THREADED_DISPATCH) && !defined(NO_THREADED_DISPATCH)
+	return TrackRunThreaded<S>;
+#else
+	return TrackRunSwitch<S>;
+#endif
+}
+
+//! every backend built in, for -bench
+static const struct {
+	const char *gName;
+	TrackRun_t  gRun;
+} gBackend[] = {
+	{"switch",   TrackRunSwitch<SmfSink_t>},
+#ifdef HAVE_THREADED_DISPATCH
+	{"threaded", TrackRunThreaded<SmfSink_t>},
+#endif
+};
+
+/**************************************/
+
+//! track finished, or stopped by a budget
+static void TrackReport(Converter_t *cv, Track_t *trk) {
+	u32 i = trk->gIndx;
+	if(trk->gOver) {
+		cv->Print("  Track %02u stopped: %s budget spent\n", i, gBudName[trk->gOver]);
+		LOG(cv->gLog, LOG_INFO, "  Trk %02u over budget\n", i);
+		return;
+	}
+	cv->Print("  Track %02u OK\n", i);
+	LOG(cv->gLog, LOG_INFO, "  Trk %02u OK\n", i);
+}
+
+//! run every started track to its end
+static void TracksRun(Converter_t *cv, TrackRun_t run, bool report) {
+	//! process while there's tracks
+	//! this setup is needed 'just in case'
+	//! as tracks can spawn from *any* track
+	bool gTrkCnt = true;
+	while(gTrkCnt) {
+		//! flip process flag
+		gTrkCnt = false;
+		
+		//! process each track
+		for(u32 i=0;i<16;i++) {
+			//! verify track is active
+			Track_t *trk = &cv->gTrack[i];
+			if(!trk->gStat) continue;
+			
+			//! continue the main loop as we have a track
+			gTrkCnt = true;
+			
+			//! loop until end of track
+			run(cv, trk, i);
+			if(cv->gErr) return;
 			
 			//! done \o/
-			printf("  Track %02u OK\n", i);
-			DebugMsg("  Trk %02u OK\n", i);
+			if(report) TrackReport(cv, trk);
 		}
 	}
+}
+
+/**************************************/
+
+//! run track 0 and every track it spawns, one worker per track
+static void TracksRunParallel(Converter_t *cv, TrackRun_t run, bool report) {
+	cv->gSched.gRun = run;
+	cv->gSched.gOn  = true;
+	memset(cv->gSched.gBusy, 0, sizeof(cv->gSched.gBusy));
+	memset(cv->gSched.gRan,  0, sizeof(cv->gSched.gRan));
+	memset(cv->gSched.gWake, 0, sizeof(cv->gSched.gWake));
 	
-	//! write midi. yay.
-	u32 trkMax = 0;
-	for(int i=0;i<16;i++) if(gData.gTrack[i].gData.size()) trkMax++;
+	//! track 0 is already started, its splits can't push before it's in
+	{
+		lock_guard<mutex> lock(cv->gSched.gLock);
+		cv->gSched.gBusy[0] = 1;
+		cv->gSched.gWork.push_back(thread(TrackWorker, cv, 0));
+	}
 	
-	//! MThd header
-	//! 96-tick per quarter-note resolution
-	struct {
-		u32 id;
-		u32 size;
-		u16 format;
-		u16 tracks;
-		u16 time;
-	} midiHeader = {
-		Swap32(0x4D546864),
-		Swap32(6),
-		Swap16(1),
-		Swap16(trkMax),
-		Swap16(96),
-	}; fwrite(&midiHeader, 14, 1, midi);
+	//! workers only spawn while alive, so joining in order sees them all
+	//! gWork is only touched under gLock, spawning workers push to it
+	for(u32 k=0;;k++) {
+		thread w;
+		{
+			lock_guard<mutex> lock(cv->gSched.gLock);
+			if(k >= cv->gSched.gWork.size()) break;
+			w.swap(cv->gSched.gWork[k]);
+		}
+		w.join();
+	}
+	{
+		lock_guard<mutex> lock(cv->gSched.gLock);
+		cv->gSched.gWork.clear();
+		cv->gSched.gOn = false;
+	}
 	
-	//! process each track
-	for(int i=0;i<16;i++) {
-		//! have data?
-		u32 len = gData.gTrack[i].gData.size();
-		if(!len) continue;
+	//! done \o/
+	if(report && !cv->gErr) for(u32 i=0;i<16;i++) {
+		if(cv->gSched.gRan[i]) TrackReport(cv, &cv->gTrack[i]);
+	}
+}
+
+/**************************************/
+
+u32 Converter_t::Decode(Cursor_t &rseq, Cursor_t &code, vector<u32> *entry) {
+	u32 mdOff = gDATAHead.fOff;
+	Program_t &prog = gProg;
+	
+	//! debug
+	LOG(gLog, LOG_INFO, "  Begin decoding...\n");
+	
+	//! commands only come from the DATA chunk
+	code.Init(rseq.gBase, min(gDATAHead.fEnd, rseq.gSize));
+	u32 room = (code.gSize > mdOff) ? code.gSize - mdOff : 0;
+	
+	//! decode everything reachable from the sequence start ...
+	vector<u32> adrs(1, mdOff);
+	
+	//! ... and from every label, in LABL order
+	if(entry) for(u32 i=0;i<gLabels.size();i++) {
+		u32 pos = gLabels[i].pos;
+		adrs.push_back((pos < room) ? pos + mdOff : code.gSize);
+	}
+	
+	prog.Decode(code, mdOff, adrs, &gLabels);
+	u32 start = adrs[0];
+	if(entry) entry->insert(entry->end(), adrs.begin() + 1, adrs.end());
+	gCode = &prog;
+	LOG(gLog, LOG_INFO, "  Decoded %u commands\n", (u32)prog.gInsn.size());
+	return start;
+}
+
+bool Converter_t::Do(Cursor_t &rseq, vector<u8> &smf) {
+	Cursor_t code;
+	u32 entry = Decode(rseq, code, NULL);
+	return Render(gDATAHead.fOff, entry, smf);
+}
+
+bool Converter_t::Render(u32 adr, u32 entry, vector<u8> &smf) {
+	//! -scan only counts what the SMF would hold, -events keeps columns
+	TrackRun_t run = gOpt.gScan   ? TrackRun<CountSink_t>() :
+	                 (gOpt.gEvents || gOpt.gFormat0) ? TrackRun<EventSink_t>() : TrackRun<SmfSink_t>();
+	
+	//! start track 0, then everything it spawns
+	gTrack[0].Start(adr, entry);
+	if(gOpt.gParTrk) TracksRunParallel(this, run, true);
+	else             TracksRun(this, run, true);
+	
+	//! bad data, no output
+	if(gErr) {
+		const char *what = (gErr == CUR_TRUNC) ? "command cut off by end of chunk" :
+		                   (gErr == CUR_TRACK) ? "split to a track past 15" :
+		                   (gErr == CUR_TEMPO) ? "tempo 0" : "track left the chunk";
+		Print("  Corrupt DATA: %s at 0x%X\n", what, gEPos);
+		LOG(gLog, LOG_INFO, "  Aborted: %s at 0x%X\n", what, gEPos);
+		return false;
+	}
+	
+	//! -scan only wants the tracks' counters
+	if(gOpt.gScan) return true;
+	
+	//! format 0 merges the event lists straight into one track
+	if(gOpt.gFormat0) {
+		SmfMerge(this, smf);
+		return true;
+	}
+	
+	//! build midi. yay.
+	SmfBuild(this, smf);
+	return true;
+}
+
+/**************************************/
+
+//! append printf-style text
+static void Text(vector<u8> &out, const char *str, ...) {
+	char buf[0x200];
+	va_list myList;
+	va_start(myList, str);
+	int n = vsnprintf(buf, sizeof(buf), str, myList);
+	va_end(myList);
+	if(n > (int)sizeof(buf) - 1) n = sizeof(buf) - 1;
+	if(n > 0) out.insert(out.end(), buf, buf + n);
+}
+
+//! label text for a -scan or -analyze record, separators + anything
+//! unprintable as \xNN so a record stays one line of space-separated fields
+static void ScanText(string &line, const u8 *text, u32 len) {
+	char buf[8];
+	for(u32 i=0;i<len;i++) {
+		u8 ch = text[i];
+		if(isgraph(ch) && ch != ',' && ch != '=' && ch != '\\') line += (char)ch;
+		else {
+			snprintf(buf, sizeof(buf), "\\x%02X", ch);
+			line += buf;
+		}
+	}
+}
+
+bool Converter_t::Analyze(Cursor_t &rseq, vector<u8> &out) {
+	u32 mdOff = gDATAHead.fOff;
+	Program_t &prog = gProg;
+	
+	LOG(gLog, LOG_INFO, "  Begin analysis...\n");
+	
+	//! decode from the sequence start and every label
+	Cursor_t code;
+	vector<u32> entry;
+	entry.push_back(Decode(rseq, code, &entry));
+	u32 room = (code.gSize > mdOff) ? code.gSize - mdOff : 0;
+	
+	Flow_t flow;
+	flow.Build(prog, code, mdOff, entry, gOpt.gIgnJump);
+	flow.Reach(prog, entry, gOpt.gIgnJump, gOpt.gLoops);
+	flow.Cycles(prog);
+	
+	//! one record per line: kind, then offsets relative to DATA
+	out.clear();
+	Text(out, "# rseq2midi control flow, offsets relative to DATA\n");
+	Text(out, "data 0x%X\n", room);
+	Text(out, "entry 0x0 start\n");
+	for(u32 i=0;i<gLabels.size();i++) {
+		string name;
+		ScanText(name, gLabels[i].text, gLabels[i].len);
+		Text(out, "entry 0x%X label ", gLabels[i].pos);
+		out.insert(out.end(), name.begin(), name.end());
+		Text(out, "\n");
+	}
+	
+	u32 stall = 0;
+	for(u32 c=0;c<flow.gCycle.size();c++) {
+		const Cycle_t &cy = flow.gCycle[c];
+		Text(out, "cycle 0x%X %u %s%s\n", cy.gHead - mdOff, cy.gCount, cy.gWait ? "wait" : "stall", cy.gCall ? " call" : "");
+		if(!cy.gWait) stall++;
+	}
+	
+	//! reachable ranges, begin/end pairs
+	vector<u32> range;
+	
+	//! blocks + the commands worth knowing about, by position
+	//! only what can run, dead fall-through and padding are gaps
+	u32 live = 0;
+	for(u32 b=0;b<flow.gBlock.size();b++) {
+		if(!flow.gLive[b]) continue;
+		live++;
+		
+		const Block_t &blk = flow.gBlock[b];
+		u32 beg = prog.gInsn[blk.gHead].gPos;
+		
+		Text(out, "block 0x%X 0x%X", beg - mdOff, blk.gEnd - mdOff);
+		for(u32 k=0;k<2;k++) {
+			if(blk.gSucc[k] == INSN_NONE || !flow.gLive[blk.gSucc[k]]) continue;
+			Text(out, " 0x%X", prog.gInsn[flow.gBlock[blk.gSucc[k]].gHead].gPos - mdOff);
+		}
+		Text(out, "\n");
+		
+		for(u32 t=blk.gHead;;t=prog.Next(t)) {
+			const Insn_t &op = prog.gInsn[t];
+			u32 pos = op.gPos - mdOff;
+			switch(op.gCmd) {
+				case 0x88:
+					Text(out, "split 0x%X %u 0x%X\n", pos, op.gArg1, op.gArg0 - mdOff);
+					break;
+				case 0x89:
+					if(op.gArg0 <= op.gPos + 4) Text(out, "loop 0x%X 0x%X\n", pos, op.gArg0 - mdOff);
+					break;
+				case 0x8A:
+					Text(out, "call 0x%X 0x%X\n", pos, op.gArg0 - mdOff);
+					break;
+				case INSN_EOF:
+					Text(out, "bad 0x%X %s\n", pos, (op.gArg0 == CUR_TRUNC) ? "trunc" : (op.gArg0 == CUR_TRACK) ? "track" :
+						(op.gArg0 == CUR_TEMPO) ? "tempo" : "range");
+					break;
+				default:
+					if(gCmdDesc[op.gCmd].gMap == MAP_UNKNOWN) Text(out, "unknown 0x%X 0x%02X\n", pos, op.gCmd);
+					break;
+			}
+			if(t == blk.gTail) break;
+		}
 		
-		//! yop, create MTrk struct
-		struct {
-			u32 id;
-			u32 len;
-		} trkHead = {
-			Swap32(0x4D54726B),
-			Swap32(len),
-		}; fwrite(&trkHead, 8, 1, midi);
-		
-		//! dump all data
-		for(u32 j=0;j<len;j++) fputc(gData.gTrack[i].gData[j], midi);
-	} fclose(midi);
+		//! merge into reachable ranges
+		if(beg >= code.gSize) continue;
+		if(!range.empty() && beg <= range.back()) range.back() = max(range.back(), blk.gEnd);
+		else {
+			range.push_back(beg);
+			range.push_back(blk.gEnd);
+		}
+	}
+	
+	//! ... and the unreachable gaps between them
+	u32 last = mdOff;
+	for(u32 r=0;r<range.size();r+=2) {
+		if(range[r] > last) Text(out, "gap 0x%X 0x%X\n", last - mdOff, range[r] - mdOff);
+		Text(out, "range 0x%X 0x%X\n", range[r] - mdOff, range[r+1] - mdOff);
+		last = range[r+1];
+	}
+	if(code.gSize > last) Text(out, "gap 0x%X 0x%X\n", last - mdOff, code.gSize - mdOff);
+	
+	Print("  %u commands, %u blocks, %u cycles (%u stalled)\n",
+		(u32)prog.gInsn.size(), live, (u32)flow.gCycle.size(), stall);
+	LOG(gLog, LOG_INFO, "  Analyzed %u commands, %u stalled cycles\n", (u32)prog.gInsn.size(), stall);
+	return true;
 }
 
 /**************************************/
 
-void rseqProc(const char *filename, FILE *rseq) {
+bool Converter_t::Proc(Cursor_t &rseq) {
 	u32 tPos;
-	RSEQHead_t &rcnk = gData.gRSEQHead;
-	DATAHead_t &dcnk = gData.gDATAHead;
-	LABLHead_t &lcnk = gData.gLABLHead;
+	RSEQHead_t &rcnk = gRSEQHead;
+	DATAHead_t &dcnk = gDATAHead;
+	LABLHead_t &lcnk = gLABLHead;
 	
 	//! reset data
-	gData.Reset();
-	DebugMsg("  State reset successfully\n");
+	Reset();
+	LOG(gLog, LOG_INFO, "  State reset successfully\n");
 	
 	//! write out debug message - position in code
-	DebugMsg("  Attempting to read RSEQ chunk...\n");
+	LOG(gLog, LOG_INFO, "  Attempting to read RSEQ chunk...\n");
 	
 	/* read RSEQ chunk */ {
 		//! save position + read header
-		tPos        = ftell(rseq);
+		tPos        = rseq.Tell();
 		rcnk.id     = ReadLE(rseq, 32);
 		rcnk.magic  = ReadBE(rseq, 32);
 		rcnk.size   = ReadBE(rseq, 32);
@@ -1008,8 +3031,8 @@ void rseqProc(const char *filename, FILE *rseq) {
 		//! validate
 		if(memcmp(&rcnk.id, "RSEQ", 4) || rcnk.magic != 0xFEFF0100) {
 			//! failed
-			printf("Invalid RSEQ file (bad RSEQ chunk)\n");
-			DebugMsg(
+			Print("Invalid RSEQ file (bad RSEQ chunk)\n");
+			LOG(gLog, LOG_INFO, 
 				"  Bad RSEQ chunk\n"
 				"    Chunk ID          = 0x%08X\n"
 				"    Chunk Magic       = 0x%08X\n"
@@ -1022,15 +3045,15 @@ void rseqProc(const char *filename, FILE *rseq) {
 				rcnk.cSize,
 				rcnk.cBlock
 			);
-			return;
+			return false;
 		}
 		
 		//! skip header
-		fseek(rseq, tPos + rcnk.cSize, SEEK_SET);
+		rseq.Seek(tPos + rcnk.cSize);
 	}
 	
 	//! print off debug message
-	DebugMsg(
+	LOG(gLog, LOG_INFO, 
 		"  RSEQ chunk OK\n"
 		"    Chunk ID          = 0x%08X\n"
 		"    Chunk Magic       = 0x%08X\n"
@@ -1048,7 +3071,7 @@ void rseqProc(const char *filename, FILE *rseq) {
 	u32 ckLen = 0; //! just to shut GCC up
 	for(u32 i=0;i<rcnk.cBlock;i++) {
 		//! save position
-		tPos = ftell(rseq);
+		tPos = rseq.Tell();
 		
 		//! read ID
 		u32 id = ReadLE(rseq, 32);
@@ -1056,16 +3079,17 @@ void rseqProc(const char *filename, FILE *rseq) {
 		//! data chunk?
 		if(!memcmp(&id, "DATA", 4)) {
 			//! flag up data chunk
-			gData.gStat |= CHNK_HAVE_DATA;
+			gStat |= CHNK_HAVE_DATA;
 			
 			//! DATA chunk
 			dcnk.id     = id;
 			dcnk.size   = ckLen = ReadBE(rseq, 32);
 			dcnk.offset = ReadBE(rseq, 32);
 			dcnk.fOff   = tPos + dcnk.offset;
+			dcnk.fEnd   = tPos + dcnk.size;
 			
 			//! debug stuff
-			DebugMsg(
+			LOG(gLog, LOG_INFO, 
 				"  Have DATA chunk\n"
 				"    Chunk ID     = 0x%08X\n"
 				"    Chunk size   = %u bytes\n"
@@ -1081,7 +3105,7 @@ void rseqProc(const char *filename, FILE *rseq) {
 		//! label chunk?
 		else if(!memcmp(&id, "LABL", 4)) {
 			//! flag up label chunk
-			gData.gStat |= CHNK_HAVE_LABL;
+			gStat |= CHNK_HAVE_LABL;
 			
 			//! LABL chunk
 			lcnk.id     = id;
@@ -1090,73 +3114,617 @@ void rseqProc(const char *filename, FILE *rseq) {
 			lcnk.lOff   = tPos + 8;
 			
 			//! debug stuff
-			DebugMsg("  Have LABL chunk\n");
+			LOG(gLog, LOG_INFO, "  Have LABL chunk\n");
 			
-			std::vector<u32> lOffsets;
-			for (u32 i = 0; i < lcnk.labels; i ++)
+			//! entries: offset table, each one points at pos + len + text
+			//! the count is only trusted as far as the table fits the chunk
+			u32 lTab = rseq.Tell();
+			u32 lEnd = (tPos + (u64)ckLen < rseq.gSize) ? tPos + ckLen : rseq.gSize;
+			u32 lMax = (lEnd > lTab) ? (lEnd - lTab) / 4 : 0;
+			if (lcnk.labels > lMax)
 			{
-				u32 lpos = ReadBE(rseq, 32) + lcnk.lOff;
-				lOffsets.push_back(lpos);
+				LOG(gLog, LOG_INFO, "  LABL claims %u labels, room for %u\n", lcnk.labels, lMax);
+				lcnk.labels = lMax;
 			}
+			u32 lRoom = (lEnd > lcnk.lOff) ? lEnd - lcnk.lOff : 0;
+			gLabels.reserve(lcnk.labels);
 			for (u32 i = 0; i < lcnk.labels; i ++)
 			{
-				fseek(rseq, lOffsets[i], SEEK_SET);
-				u32 seqpos = ReadBE(rseq, 32);
-				u32 lbllen = ReadBE(rseq, 32);
-				char* lbldata = new char[lbllen];
-				fread(lbldata, 1, lbllen, rseq);
+				rseq.Seek(lTab + i*4);
+				u32 lPos = ReadBE(rseq, 32);
+				
+				//! entry + text have to lie in the chunk
+				if (lRoom < 8 || lPos > lRoom - 8)
+				{
+					LOG(gLog, LOG_INFO, "  Label %u outside LABL, skipped\n", i);
+					continue;
+				}
+				rseq.Seek(lPos + lcnk.lOff);
 				
-				std::string lblstr = std::string(lbldata, lbllen);
-				gData.gLabels[seqpos] = lblstr;
-				delete[] lbldata;
+				rseq_label_entry_t lbl;
+				lbl.pos  = ReadBE(rseq, 32);
+				lbl.len  = ReadBE(rseq, 32);
+				if (lbl.len > lRoom - 8 - lPos)
+				{
+					LOG(gLog, LOG_INFO, "  Label %u text outside LABL, skipped\n", i);
+					continue;
+				}
+				lbl.text = rseq.View(lbl.len);
+				gLabels.push_back(lbl);
+			}
+			
+			//! sort by position, last entry wins on duplicates
+			stable_sort(gLabels.begin(), gLabels.end(),
+				[](const rseq_label_entry_t &a, const rseq_label_entry_t &b) { return a.pos < b.pos; });
+			u32 n = 0;
+			for (u32 i = 0; i < gLabels.size(); i ++)
+			{
+				if (n && gLabels[n-1].pos == gLabels[i].pos) n--;
+				gLabels[n++] = gLabels[i];
 			}
-			DebugMsg("  Read %u labels\n", lcnk.labels);
+			gLabels.resize(n);
+			LOG(gLog, LOG_INFO, "  Read %u labels\n", lcnk.labels);
 		}
 		
 		//! skip chunk
-		fseek(rseq, tPos + ckLen, SEEK_SET);
+		rseq.Seek(tPos + ckLen);
 	}
 	
 	//! can be decoded?
-	if(!BOOL_EQUAL(gData.gStat, CHNK_NEEDED)) {
+	if(!BOOL_EQUAL(gStat, CHNK_NEEDED)) {
 		//! fail - not enough data to decode
-		printf("Not enough data to decode with\n");
-		DebugMsg("  Insufficient data (exit code 0x%02X, needed 0x%02X)\n", gData.gStat, CHNK_NEEDED);
-		return;
+		Print("Not enough data to decode with\n");
+		LOG(gLog, LOG_INFO, "  Insufficient data (exit code 0x%02X, needed 0x%02X)\n", gStat, CHNK_NEEDED);
+		return false;
 	}
 	
-	//! create target MIDI filename
-	char *newFN = new char[strlen(filename)+1]; strcpy(newFN, filename);
-	if(char *p = strrchr(newFN, '.')) strcpy(p, ".mid");
-	else strcat(newFN, ".mid");
-	DebugMsg("  Writing to %s\n", newFN);
+	return true;
+}
+
+/**************************************/
+
+//! budget from the outside, 0 is unlimited
+static u32 Budget(unsigned long n) {
+	return (n && n < 0xFFFFFFFF) ? n : 0xFFFFFFFF;
+}
+
+//! library entry point, see rseq2midi.h
+int rseq2midi_convert(const void *in, size_t n, unsigned flags, rseq2midi_buf_t *out) {
+	return rseq2midi_convert_ex(in, n, flags, NULL, out);
+}
+
+int rseq2midi_convert_ex(const void *in, size_t n, unsigned flags, const rseq2midi_limits_t *limits, rseq2midi_buf_t *out) {
+	if(!out) return RSEQ2MIDI_EARG;
+	out->data = NULL;
+	out->size = 0;
+	
+	//! cursor offsets are 32-bit
+	if(!in || n > 0xFFFFFFFF) return RSEQ2MIDI_EARG;
+	
+	Options_t opt;
+	opt.Default();
+	opt.gIgnJump = (flags & RSEQ2MIDI_IGNORE_JUMPS) != 0;
+	opt.gDbgCtrl = (flags & RSEQ2MIDI_DEBUG_CTRLS)  != 0;
+	opt.gRunStat = (flags & RSEQ2MIDI_RUN_STATUS)   != 0;
+	opt.gParTrk  = (flags & RSEQ2MIDI_PAR_TRACKS)   != 0;
+	opt.gEvents  = (flags & RSEQ2MIDI_EVENTS)       != 0;
+	opt.gFormat0 = (flags & RSEQ2MIDI_FORMAT0)      != 0;
+	if(limits) {
+		opt.gMaxInsn = Budget(limits->commands);
+		opt.gMaxTick = Budget(limits->ticks);
+		opt.gMaxTrkB = Budget(limits->track_bytes);
+		opt.gMaxFilB = Budget(limits->file_bytes);
+	}
+	
+	//! nothing may escape into C callers
+	try {
+		//! console output stays in the converter
+		Converter_t cv(opt, NULL);
+		cv.gBuf = true;
+		
+		Cursor_t rseq;
+		rseq.Init((const u8*)in, n);
+		if(!cv.Proc(rseq)) return RSEQ2MIDI_EFORMAT;
+		
+		vector<u8> smf;
+		if(!cv.Do(rseq, smf)) return RSEQ2MIDI_ECORRUPT;
+		
+		//! hand over in a malloc'd block, C side frees it
+		out->data = (unsigned char*)malloc(smf.size());
+		if(!out->data) return RSEQ2MIDI_EMEMORY;
+		memcpy(out->data, &smf[0], smf.size());
+		out->size = smf.size();
+	} catch(const bad_alloc&) {
+		return RSEQ2MIDI_EMEMORY;
+	} catch(...) {
+		return RSEQ2MIDI_EFAIL;
+	}
+	
+	return RSEQ2MIDI_OK;
+}
+
+void rseq2midi_free(rseq2midi_buf_t *out) {
+	if(!out) return;
+	free(out->data);
+	out->data = NULL;
+	out->size = 0;
+}
+
+/**************************************/
+
+//! command line front end, left out of library builds
+#ifndef RSEQ2MIDI_LIB
+
+//! compare dispatch backends on a synthetic note/wait-dense sequence
+static int rseqBench(u32 notes) {
+	const u32 nBackend = sizeof(gBackend)/sizeof(gBackend[0]);
+	const u32 passes   = 5;
+	
+	if(!notes) notes = 20000;
+	
+	//! track 0 splits off 1-15, every track is note + rest pairs
+	vector<u8> seq;
+	vector<u32> fix;
+	PushBE(seq, 0xFEFFFF, 24);
+	for(u32 t=1;t<16;t++) {
+		seq.push_back(0x88);
+		seq.push_back(t);
+		fix.push_back(seq.size());
+		PushBE(seq, 0, 24);
+	}
+	for(u32 t=0;t<16;t++) {
+		if(t) {
+			u32 at = fix[t-1], adr = seq.size();
+			seq[at+0] = adr >> 16;
+			seq[at+1] = adr >>  8;
+			seq[at+2] = adr >>  0;
+		}
+		for(u32 n=0;n<notes;n++) {
+			seq.push_back((n*7 + t*5) & 0x7F);
+			seq.push_back(100);
+			seq.push_back(1 + (n&3)*12);
+			seq.push_back(0x80);
+			seq.push_back(12);
+		}
+		seq.push_back(0xFF);
+	}
+	
+	//! decode once, like a real conversion
+	Options_t opt;
+	opt.Default();
+	Converter_t cv(opt, NULL);
+	Cursor_t rseq;
+	rseq.Init(&seq[0], seq.size());
+	vector<u32> start(1, 0);
+	cv.gProg.Decode(rseq, 0, start, NULL);
+	u32 entry = start[0];
+	u32 cmds  = cv.gProg.gInsn.size();
+	
+	printf("rseq2midi benchmark: 16 tracks, %u commands\n", cmds);
+	
+	vector<u8> ref, smf;
+	int ret = 0;
+	for(u32 b=0;b<nBackend;b++) {
+		double best = 0;
+		for(u32 p=0;p<passes;p++) {
+			for(int i=0;i<16;i++) cv.gTrack[i].Reset(i);
+			cv.gTrack[0].Start(0, entry);
+			
+			chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+			TracksRun(&cv, gBackend[b].gRun, false);
+			chrono::duration<double> dt = chrono::steady_clock::now() - t0;
+			if(!p || dt.count() < best) best = dt.count();
+		}
+		
+		//! every backend has to produce the same file
+		SmfBuild(&cv, smf);
+		if(!b) ref = smf;
+		bool same = (smf == ref);
+		if(!same) ret = 1;
+		
+		printf("  %-8s %8.2f ms  %6.2f ns/cmd  %s\n",
+			gBackend[b].gName, best*1e3, best*1e9/cmds, same ? "OK" : "MISMATCH");
+	}
+	
+	return ret;
+}
+
+/**************************************/
+
+//! write a finished file, "-" is stdout
+static void WriteOut(Converter_t *cv, const string &fn, const vector<u8> &data) {
+	LOG(cv->gLog, LOG_INFO, "  Writing to %s\n", fn.c_str());
+	
+	//! stdout: one write + flush
+	if(fn == "-") {
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		fwrite(&data[0], 1, data.size(), stdout);
+		fflush(stdout);
+		return;
+	}
 	
 	//! create target MIDI file
-	FILE *midi = fopen(newFN, "wb"); delete newFN;
+	FILE *midi = fopen(fn.c_str(), "wb");
 	if(!midi) {
 		//! failed to open target
-		printf("  Cannot open output Midi file\n");
-		DebugMsg("  Can't open target\n");
-		delete newFN;
+		cv->Print("  Cannot open output Midi file\n");
+		LOG(cv->gLog, LOG_INFO, "  Can't open target\n");
+		return;
+	}
+	
+	//! whole file goes out in a single write
+	setvbuf(midi, NULL, _IONBF, 0);
+	fwrite(&data[0], 1, data.size(), midi);
+	fclose(midi);
+}
+
+//! one -scan line: name, then key=value facts of the last render
+//! labels lists LABL when given, failed renders only get error=
+static void ScanRecord(Converter_t *cv, const string &name, const char *error, bool labels) {
+	char buf[0x100];
+	string line = name;
+	if(error) {
+		line += " error=";
+		line += error;
+		line += "\n";
+		cv->Record(line);
+		return;
+	}
+	
+	u32 tracks = 0, ticks = 0, notes = 0, tempos = 0, loop = 0;
+	u32 unk[8] = {0};
+	for(u32 i=0;i<16;i++) {
+		const Track_t &trk = cv->gTrack[i];
+		if(!CountSink_t::Size(trk)) continue;
+		
+		tracks++;
+		ticks   = max(ticks, trk.gGPos);
+		notes  += trk.gNSeq;
+		tempos += trk.gTmps;
+		loop   |= trk.gHasL;
+		for(u32 k=0;k<8;k++) unk[k] |= trk.gUnk[k];
+	}
+	snprintf(buf, sizeof(buf), " tracks=%u ticks=%u notes=%u tempos=%u loop=%u unknown=",
+		tracks, ticks, notes, tempos, loop);
+	line += buf;
+	
+	const char *sep = "";
+	for(u32 c=0;c<256;c++) {
+		if(!(unk[c >> 5] & (1u << (c & 31)))) continue;
+		snprintf(buf, sizeof(buf), "%s%02X", sep, c);
+		line += buf;
+		sep = ",";
+	}
+	
+	if(labels) {
+		line += " labels=";
+		for(u32 i=0;i<cv->gLabels.size();i++) {
+			if(i) line += ",";
+			ScanText(line, cv->gLabels[i].text, cv->gLabels[i].len);
+		}
+	}
+	line += "\n";
+	cv->Record(line);
+}
+
+/**************************************/
+
+//! label renders: one decoded program shared by every worker
+typedef struct {
+	Converter_t    *gMain;  //! parsed file
+	const char     *gName;  //! ... its name
+	vector<u32>     gPick;  //! labels to render [gLabels index]
+	vector<u32>     gEntry; //! first command [insn], by label
+	vector<string>  gFN;    //! output file, by pick
+	vector<string>  gOut;   //! console text, by pick
+	atomic<u32>     gNext;  //! next pick
+} LabelJob_t;
+
+static void LabelWorker(LabelJob_t *lj) {
+	const Converter_t *top = lj->gMain;
+	
+	//! own tracks, the program is the main converter's
+	Converter_t *cv = new Converter_t(top->gOpt, top->gLog.gFile);
+	cv->gBuf      = true;
+	cv->gDATAHead = top->gDATAHead;
+	cv->gLabels   = top->gLabels;
+	cv->gCode     = &top->gProg;
+	
+	u32 k;
+	vector<u8> smf;
+	while((k = lj->gNext++) < lj->gPick.size()) {
+		u32 i = lj->gPick[k];
+		const rseq_label_entry_t &lbl = cv->gLabels[i];
+		cv->Print("  %.*s -> %s\n", (int)lbl.len, lbl.text, lj->gFN[k].c_str());
+		LOG(cv->gLog, LOG_INFO, "  Label %.*s at 0x%X\n", (int)lbl.len, lbl.text, lbl.pos);
+		
+		cv->Rewind();
+		bool ok = cv->Render(lbl.pos + cv->gDATAHead.fOff, lj->gEntry[i], smf);
+		if(cv->gOpt.gScan) {
+			string name = string(lj->gName) + ":";
+			ScanText(name, lbl.text, lbl.len);
+			ScanRecord(cv, name, ok ? NULL : "corrupt", false);
+		}
+		else if(ok) WriteOut(cv, lj->gFN[k], smf);
+		lj->gOut[k].swap(cv->gOut);
+		cv->gOut.clear();
+	}
+	delete cv;
+}
+
+//! render the picked labels to base_label.mid, concurrently
+static void rseqLabels(Converter_t *cv, Cursor_t &rseq, const char *filename, const string &base, const char *outFN) {
+	LabelJob_t lj;
+	lj.gMain = cv;
+	lj.gName = filename;
+	lj.gNext = 0;
+	
+	//! which labels
+	for(u32 i=0;i<cv->gLabels.size();i++) {
+		const rseq_label_entry_t &lbl = cv->gLabels[i];
+		const char *name = cv->gOpt.gLabel;
+		if(name && (strlen(name) != lbl.len || memcmp(name, lbl.text, lbl.len))) continue;
+		lj.gPick.push_back(i);
+	}
+	if(lj.gPick.empty()) {
+		cv->Print("  No label %s\n", cv->gOpt.gLabel ? cv->gOpt.gLabel : "entries");
+		if(cv->gOpt.gScan) ScanRecord(cv, filename, "label", false);
+		return;
+	}
+	if(base == "-" && lj.gPick.size() > 1 && !cv->gOpt.gScan) {
+		cv->Print("  Several labels can't all go to stdout\n");
+		return;
+	}
+	
+	//! -o names a single label's file, else base_label.mid
+	for(u32 k=0;k<lj.gPick.size();k++) {
+		const rseq_label_entry_t &lbl = cv->gLabels[lj.gPick[k]];
+		string fn;
+		if(base == "-") fn = base;
+		else if(outFN && lj.gPick.size() == 1) fn = outFN;
+		else {
+			fn = base + "_";
+			for(u32 c=0;c<lbl.len;c++) {
+				u8 ch = lbl.text[c];
+				fn += (isalnum(ch) || ch == '-' || ch == '.') ? (char)ch : '_';
+			}
+			fn += ".mid";
+		}
+		lj.gFN.push_back(fn);
+	}
+	lj.gOut.resize(lj.gPick.size());
+	
+	//! decode once from every label
+	Cursor_t code;
+	cv->Decode(rseq, code, &lj.gEntry);
+	
+	u32 jobs = cv->gOpt.gJobs;
+	if(!jobs) jobs = thread::hardware_concurrency();
+	if(!jobs) jobs = 1;
+	if(jobs > lj.gPick.size()) jobs = lj.gPick.size();
+	
+	vector<thread> work;
+	for(u32 w=0;w<jobs;w++) work.push_back(thread(LabelWorker, &lj));
+	for(u32 w=0;w<jobs;w++) work[w].join();
+	
+	//! console text in label order
+	for(u32 k=0;k<lj.gPick.size();k++) cv->Record(lj.gOut[k]);
+}
+
+/**************************************/
+
+//! open, convert and close a single file
+//! outFN overrides the derived .mid name, "-" is stdout (default for stdin)
+static void rseqFile(Converter_t *cv, const char *filename, const char *outFN) {
+	//! print to console + debug
+	cv->Print("%s:\n", filename);
+	LOG(cv->gLog, LOG_INFO, "%s:\n", filename);
+	
+	//! open file
+	Input_t in;
+	if(!in.Open(filename)) {
+		//! can't open - skip
+		cv->Print("  Couldn't open file\n");
+		LOG(cv->gLog, LOG_INFO, "  Failed\n");
+		if(cv->gOpt.gScan) ScanRecord(cv, filename, "open", false);
+		return;
+	}
+	
+	//! read headers
+	Cursor_t rseq;
+	rseq.Init(in.gBase, in.gSize);
+	if(!cv->Proc(rseq)) {
+		in.Close();
+		if(cv->gOpt.gScan) ScanRecord(cv, filename, "format", false);
+		return;
+	}
+	
+	//! create target MIDI filename
+	string newFN;
+	if(outFN) newFN = outFN;
+	else if(!strcmp(filename, "-")) newFN = "-";
+	else newFN = filename;
+	
+	//! labels get their own files, named after the input
+	if(cv->gOpt.gAllLab || cv->gOpt.gLabel) {
+		size_t ext = newFN.rfind('.');
+		if(newFN != "-" && ext != string::npos) newFN.erase(ext);
+		rseqLabels(cv, rseq, filename, newFN, outFN);
+		cv->gProg.Release();
+		in.Close();
 		return;
 	}
 	
-	//! start processing
-	rseqDo(midi, rseq);
+	if(!outFN && newFN != "-") {
+		size_t ext = newFN.rfind('.');
+		if(ext != string::npos) newFN.erase(ext);
+		newFN += cv->gOpt.gAnalyze ? ".cfg.txt" : ".mid";
+	}
+	
+	//! render first, nothing is written for bad data
+	vector<u8> smf;
+	bool ok = (cv->gOpt.gAnalyze && !cv->gOpt.gScan) ? cv->Analyze(rseq, smf) : cv->Do(rseq, smf);
+	
+	//! label text lives in the input, so the record goes out first
+	if(cv->gOpt.gScan) ScanRecord(cv, filename, ok ? NULL : "corrupt", true);
+	
+	//! a batch worker shouldn't hold on to its largest program
+	cv->gProg.Release();
+	in.Close();
+	if(ok && !cv->gOpt.gScan) WriteOut(cv, newFN, smf);
+}
+
+/**************************************/
+
+//! batch: per-worker deque, owner pops the front, thieves take the back
+typedef struct {
+	mutex      gLock;
+	deque<u32> gJob;
+} WorkQueue_t;
+
+typedef struct {
+	char       **gFile;
+	u32          gCount;
+	WorkQueue_t *gQueue;
+	mutex        gConLock;
+	Options_t    gOpt;
+	FILE        *gLog;
+	FILE        *gCon;
+} Batch_t;
+
+static bool BatchNext(Batch_t *bt, u32 w, u32 &job) {
+	WorkQueue_t *q = &bt->gQueue[w];
+	{
+		lock_guard<mutex> lock(q->gLock);
+		if(!q->gJob.empty()) {
+			job = q->gJob.front(); q->gJob.pop_front();
+			return true;
+		}
+	}
+	
+	//! own queue empty, steal
+	for(u32 k=1;k<bt->gCount;k++) {
+		WorkQueue_t *v = &bt->gQueue[(w+k) % bt->gCount];
+		lock_guard<mutex> lock(v->gLock);
+		if(!v->gJob.empty()) {
+			job = v->gJob.back(); v->gJob.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+static void BatchWorker(Batch_t *bt, u32 w) {
+	//! own converter, nothing shared but the queues
+	Converter_t *cv = new Converter_t(bt->gOpt, bt->gLog);
+	cv->gBuf = true;
+	
+	u32 job;
+	while(BatchNext(bt, w, job)) {
+		rseqFile(cv, bt->gFile[job], NULL);
+		cv->gLog.Flush();
+		
+		//! whole file's output in one go
+		lock_guard<mutex> lock(bt->gConLock);
+		fputs(cv->gOut.c_str(), bt->gCon);
+		fflush(bt->gCon);
+		cv->gOut.clear();
+	}
+	delete cv;
+}
+
+//! size of a file, 0 if it can't be opened
+static u32 FileSize(const char *filename) {
+	FILE *f = fopen(filename, "rb");
+	if(!f) return 0;
+	fseek(f, 0, SEEK_END);
+	long n = ftell(f);
+	fclose(f);
+	return (n > 0) ? n : 0;
+}
+
+//! convert files on several workers, largest first
+static void rseqBatch(const Options_t &opt, FILE *log, FILE *con, char **files, u32 count, u32 jobs) {
+	if(!jobs) jobs = thread::hardware_concurrency();
+	if(!jobs) jobs = 1;
+	if(jobs > count) jobs = count;
+	
+	//! biggest files go out first so nothing long is left for last
+	vector<u32> size(count), order(count);
+	for(u32 i=0;i<count;i++) {
+		size[i]  = FileSize(files[i]);
+		order[i] = i;
+	}
+	stable_sort(order.begin(), order.end(),
+		[&](u32 a, u32 b) { return size[a] > size[b]; });
+	
+	//! deal round-robin, every deque stays largest-first
+	vector<WorkQueue_t> queue(jobs);
+	for(u32 i=0;i<count;i++) queue[i % jobs].gJob.push_back(order[i]);
+	
+	Batch_t bt;
+	bt.gFile  = files;
+	bt.gCount = jobs;
+	bt.gQueue = &queue[0];
+	bt.gOpt   = opt;
+	bt.gOpt.gJobs = 1;
+	bt.gLog   = log;
+	bt.gCon   = con;
+	
+	vector<thread> work;
+	for(u32 w=0;w<jobs;w++) work.push_back(thread(BatchWorker, &bt, w));
+	for(u32 w=0;w<jobs;w++) work[w].join();
 }
 
 /**************************************/
 
+//! off/info/trace or a number, NULL is off
+static u8 LogLevel(const char *str) {
+	if(!str || !strcmp(str, "off"))  return LOG_OFF;
+	if(!strcmp(str, "info"))         return LOG_INFO;
+	if(!strcmp(str, "trace"))        return LOG_TRACE;
+	u32 n = strtoul(str, NULL, 0);
+	return (n > LOG_TRACE) ? LOG_TRACE : n;
+}
+
 int main(int argc, char *argv[]) {
 	int firstarg;
+	Options_t opt;
+	u32 jobs;
+	const char *outFN;
+	const char *logFN;
 	
 	//! need at least two args
 	if(argc < 2) {
 		//! print msg
 		printf(
 			"rseq2midi\n"
-			"Usage: rseq2midi [-i] file1.rseq [file2.rseq [file3.rseq [...]]]\n"
+			"Usage: rseq2midi [-i] [-d] [-r] [-p] [-j N] file1.rseq [file2.rseq [file3.rseq [...]]]\n"
+			"       rseq2midi [options] [-o out.mid] file.rseq\n"
+			"       rseq2midi -bench [notes]\n"
 			"-i - ignore jump commands\n"
+			"-loops N - take backward jumps N times before ending the track\n"
+			"-labels - render every LABL entry to file_label.mid (all cores unless -j)\n"
+			"-label NAME - render just that entry\n"
+			"-scan - print one line of facts per file (or label), write nothing\n"
+			"-analyze - write the control flow to file.cfg.txt instead of converting\n"
+			"-events - render to a columnar event list, then encode it\n"
+			"-format0 - write every track merged into one (SMF format 0)\n"
+			"-d - write debug controllers\n"
+			"-r - use running status (smaller files)\n"
+			"-p - render tracks in parallel\n"
+			"-j N - convert N files (or labels) at once (0 = one per core)\n"
+			"-o out.mid - output file for a single input\n"
+			"'-' as input reads stdin and writes stdout, -o - writes stdout\n"
+			"-maxcmds N - commands run per track (0 = unlimited)\n"
+			"-maxticks N - ticks rendered per track (default unlimited)\n"
+			"-maxtrack N - output bytes per track\n"
+			"-maxfile N - output bytes per file\n"
+			"-log off|info|trace - log level (env RSEQ2MIDI_LOG)\n"
+			"-logfile file - log to file, - for stderr (env RSEQ2MIDI_LOGFILE)\n"
+			"-bench - time the dispatch backends on a synthetic sequence\n"
 		);
 		
 		//! failed
@@ -1164,44 +3732,96 @@ int main(int argc, char *argv[]) {
 	}
 	
 	firstarg = 1;
-	ignoreJumps = false;
-	debugCtrls = false;
+	opt.Default();
+	opt.gLogLvl  = LogLevel(getenv("RSEQ2MIDI_LOG"));
+	jobs = 1;
+	outFN = NULL;
+	logFN = getenv("RSEQ2MIDI_LOGFILE");
 	
 	for(;firstarg<argc;firstarg++)
 	{
 		if (! strcmp(argv[firstarg], "-i"))
-			ignoreJumps = true;
+			opt.gIgnJump = true;
 		else if (! strcmp(argv[firstarg], "-d"))
-			debugCtrls = true;
+			opt.gDbgCtrl = true;
+		else if (! strcmp(argv[firstarg], "-r"))
+			opt.gRunStat = true;
+		else if (! strcmp(argv[firstarg], "-p"))
+			opt.gParTrk = true;
+		else if (! strcmp(argv[firstarg], "-j") && firstarg+1 < argc)
+			jobs = opt.gJobs = strtoul(argv[++firstarg], NULL, 0);
+		else if (! strcmp(argv[firstarg], "-o") && firstarg+1 < argc)
+			outFN = argv[++firstarg];
+		else if ((! strcmp(argv[firstarg], "-loops") || ! strcmp(argv[firstarg], "--loops")) && firstarg+1 < argc)
+			opt.gLoops = strtoul(argv[++firstarg], NULL, 0);
+		else if (! strcmp(argv[firstarg], "-labels") || ! strcmp(argv[firstarg], "--labels"))
+			opt.gAllLab = true;
+		else if ((! strcmp(argv[firstarg], "-label") || ! strcmp(argv[firstarg], "--label")) && firstarg+1 < argc)
+			opt.gLabel = argv[++firstarg];
+		else if (! strcmp(argv[firstarg], "-scan") || ! strcmp(argv[firstarg], "--scan"))
+			opt.gScan = true;
+		else if (! strcmp(argv[firstarg], "-events") || ! strcmp(argv[firstarg], "--events"))
+			opt.gEvents = true;
+		else if (! strcmp(argv[firstarg], "-format0") || ! strcmp(argv[firstarg], "--format0"))
+			opt.gFormat0 = true;
+		else if (! strcmp(argv[firstarg], "-analyze") || ! strcmp(argv[firstarg], "--analyze"))
+			opt.gAnalyze = true;
+		else if (! strcmp(argv[firstarg], "-maxcmds") && firstarg+1 < argc)
+			opt.gMaxInsn = Budget(strtoul(argv[++firstarg], NULL, 0));
+		else if (! strcmp(argv[firstarg], "-maxticks") && firstarg+1 < argc)
+			opt.gMaxTick = Budget(strtoul(argv[++firstarg], NULL, 0));
+		else if (! strcmp(argv[firstarg], "-maxtrack") && firstarg+1 < argc)
+			opt.gMaxTrkB = Budget(strtoul(argv[++firstarg], NULL, 0));
+		else if (! strcmp(argv[firstarg], "-maxfile") && firstarg+1 < argc)
+			opt.gMaxFilB = Budget(strtoul(argv[++firstarg], NULL, 0));
+		else if (! strcmp(argv[firstarg], "-log") && firstarg+1 < argc)
+			opt.gLogLvl = LogLevel(argv[++firstarg]);
+		else if (! strcmp(argv[firstarg], "-logfile") && firstarg+1 < argc)
+			logFN = argv[++firstarg];
+		else if (! strcmp(argv[firstarg], "-bench"))
+			return rseqBench((firstarg+1 < argc) ? strtoul(argv[firstarg+1], NULL, 0) : 0);
 		else
 			break;
 	}
 	
-	//! read every arg
+	//! -o names one file
+	if(outFN && argc-firstarg != 1) {
+		printf("-o needs exactly one input file\n");
+		return 1;
+	}
+	
+	//! MIDI on stdout, messages go to stderr; -scan writes no MIDI
+	FILE *con = stdout;
+	if(outFN && !strcmp(outFN, "-")) con = stderr;
 	for(int i=firstarg;i<argc;i++) {
-		//! print to console + debug
-		printf("%s:\n", argv[i]);
-		DebugMsg("%s:\n", argv[i]);
-		
-		//! open file
-		FILE *rseq = fopen(argv[i], "rb");
-		if(!rseq) {
-			//! can't open - skip
-			printf("  Couldn't open file\n");
-			DebugMsg("  Failed\n");
-			continue;
-		}
-		
-		//! process file
-		rseqProc(argv[i], rseq);
-		
-		//! close file
-		fclose(rseq);
+		if(!strcmp(argv[i], "-")) con = stderr;
+	}
+	if(opt.gScan) con = stdout;
+	
+	//! log sink, shared by every converter, only opened when logging
+	FILE *log = NULL;
+	if(opt.gLogLvl != LOG_OFF) {
+		if(!logFN) logFN = "rseq2midi.log.txt";
+		log = strcmp(logFN, "-") ? fopen(logFN, "wt") : stderr;
 	}
 	
+	if(jobs != 1 && argc-firstarg > 1) {
+		//! several files at once
+		rseqBatch(opt, log, con, &argv[firstarg], argc-firstarg, jobs);
+	} else {
+		//! read every arg
+		Converter_t *cv = new Converter_t(opt, log);
+		cv->gCon = con;
+		for(int i=firstarg;i<argc;i++) rseqFile(cv, argv[i], outFN);
+		delete cv;
+	}
+	
+	if(log && log != stderr) fclose(log);
 	return 0;
 }
 
+#endif
+
 /**************************************/
 /* EOF                                */
 /**************************************/
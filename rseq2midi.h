@@ -0,0 +1,84 @@
+/**************************************/
+/* rseq2midi - RSEQ Conversion Tool   */
+/* Copyright (C) 2010-11, Ruben Nunez */
+/**************************************/
+/* Library interface                  */
+/*                                    */
+/* Build rseq2midi.cpp with           */
+/* -DRSEQ2MIDI_LIB to leave out the   */
+/* command line front end:            */
+/*   static: compile, then ar rcs     */
+/*     librseq2midi.a rseq2midi.o     */
+/*   shared: add -fPIC -shared, and   */
+/*     -DRSEQ2MIDI_SHARED on Windows  */
+/**************************************/
+#ifndef RSEQ2MIDI_H
+#define RSEQ2MIDI_H
+/**************************************/
+#include <stddef.h>
+/**************************************/
+#if defined(_WIN32) && defined(RSEQ2MIDI_SHARED)
+# ifdef RSEQ2MIDI_LIB
+#  define RSEQ2MIDI_API __declspec(dllexport)
+# else
+#  define RSEQ2MIDI_API __declspec(dllimport)
+# endif
+#else
+# define RSEQ2MIDI_API
+#endif
+/**************************************/
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**************************************/
+
+//! conversion flags
+#define RSEQ2MIDI_IGNORE_JUMPS (0x01) //! -i
+#define RSEQ2MIDI_DEBUG_CTRLS  (0x02) //! -d
+#define RSEQ2MIDI_RUN_STATUS   (0x04) //! -r
+#define RSEQ2MIDI_PAR_TRACKS   (0x08) //! -p
+#define RSEQ2MIDI_EVENTS       (0x10) //! -events
+#define RSEQ2MIDI_FORMAT0      (0x20) //! -format0
+
+//! return codes
+#define RSEQ2MIDI_OK       ( 0) //! converted
+#define RSEQ2MIDI_EARG     (-1) //! bad arguments
+#define RSEQ2MIDI_EFORMAT  (-2) //! not a convertible RSEQ
+#define RSEQ2MIDI_EMEMORY  (-3) //! out of memory
+#define RSEQ2MIDI_EFAIL    (-4) //! anything else
+#define RSEQ2MIDI_ECORRUPT (-5) //! DATA truncated or corrupt
+
+//! output buffer, release with rseq2midi_free
+typedef struct {
+	unsigned char *data;
+	size_t         size;
+} rseq2midi_buf_t;
+
+//! per-conversion budgets, 0 is unlimited
+//! a track over budget is ended early, the rest still converts
+typedef struct {
+	unsigned long commands;    //! commands run per track
+	unsigned long ticks;       //! ticks rendered per track
+	unsigned long track_bytes; //! output bytes per track
+	unsigned long file_bytes;  //! output bytes per file
+} rseq2midi_limits_t;
+
+//! convert n bytes of RSEQ at in to a Standard MIDI File in out
+//! reentrant, no files are touched and nothing is printed
+RSEQ2MIDI_API int rseq2midi_convert(const void *in, size_t n, unsigned flags, rseq2midi_buf_t *out);
+
+//! same with explicit budgets, NULL uses the command line defaults
+RSEQ2MIDI_API int rseq2midi_convert_ex(const void *in, size_t n, unsigned flags, const rseq2midi_limits_t *limits, rseq2midi_buf_t *out);
+
+//! release a buffer filled by rseq2midi_convert
+RSEQ2MIDI_API void rseq2midi_free(rseq2midi_buf_t *out);
+
+/**************************************/
+#ifdef __cplusplus
+}
+#endif
+/**************************************/
+#endif
+/**************************************/
+/* EOF                                */
+/**************************************/